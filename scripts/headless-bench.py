@@ -0,0 +1,234 @@
+#!/bin/env python3
+
+"""
+Run Wayfire on the headless backend with the pixman renderer, drive a
+scripted workload over IPC and collect the frame statistics of the
+ammen99-bench plugin into a JSON report.
+"""
+
+import argparse
+import glob
+import json as js
+import math
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from wdbg import WayfireSocket
+
+def write_config(path, args):
+    # stipc adds a virtual pointer, the headless backend has no input devices
+    plugins = "ipc ipc-rules stipc vswitch ammen99-bench ammen99-ipc ammen99-debugging show-cursor"
+    with open(path, "w") as f:
+        f.write(f"""[core]
+plugins = {plugins}
+
+[ammen99-bench]
+average_frames = {args.phase_duration}
+show_overlay = false
+presentation_feedback = true
+
+[show-cursor]
+start_enabled = false
+measure_latency = true
+""")
+
+def wait_for(condition, timeout, what):
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        if condition():
+            return
+        time.sleep(0.05)
+    raise Exception(f"Timed out waiting for {what}")
+
+def list_toplevels(sock):
+    views = sock.call("window-rules/list-views")
+    return [v for v in views if v.get("role") == "toplevel" and v.get("mapped", True)]
+
+def find_wayland_display(runtime_dir):
+    # The runtime directory is private to this run, so Wayfire's socket is the only one in it
+    sockets = [s for s in glob.glob(os.path.join(runtime_dir, "wayland-*")) if not s.endswith(".lock")]
+    return sockets[0] if sockets else None
+
+def run_workload(sock, args, wayfire, client_env, clients):
+    report = {"clients": args.clients, "client-command": args.client_command, "phases": {}, "skipped": {}}
+
+    def skip(name, reason):
+        # A phase without its workload would only measure an idle output
+        print(f"Phase {name} skipped: {reason}", flush=True)
+        report["skipped"][name] = reason
+
+    def phase(name, action=None):
+        if wayfire.poll() is not None:
+            raise Exception(f"Wayfire exited during phase {name}")
+
+        print(f"Phase {name}...", flush=True)
+        start = time.monotonic()
+        end = start + args.phase_duration
+        while True:
+            if action:
+                action(time.monotonic() - start)
+            if time.monotonic() >= end:
+                break
+            time.sleep(1 / 60)
+
+        report["phases"][name] = sock.call("ammen99/bench/stats")["outputs"]
+
+    phase("idle")
+
+    if args.clients > 0:
+        for _ in range(args.clients):
+            clients.append(subprocess.Popen(args.client_command, shell=True, env=client_env,
+                                            stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL))
+        wait_for(lambda: len(list_toplevels(sock)) >= args.clients, 10, f"{args.clients} clients to map")
+        phase("clients")
+
+        views = list_toplevels(sock)
+        def move_resize(t):
+            for i, v in enumerate(views):
+                offset = int(100 * ((t * 2 + i * 0.3) % 1.0))
+                sock.call("window-rules/configure-view", {"id": v["id"], "geometry": {
+                    "x": 50 + 40 * i + offset, "y": 50 + 30 * i + offset,
+                    "width": 400 + offset, "height": 300 + offset}})
+        phase("move-resize", move_resize)
+    else:
+        skip("clients", f"{args.client_command} not found")
+        skip("move-resize", f"{args.client_command} not found")
+
+    output = sock.call("window-rules/list-outputs")[0]
+    geometry = output["geometry"]
+
+    # Move the pointer in a circle, each motion moves the indicator
+    def warp_pointer(t):
+        x = geometry["x"] + geometry["width"] / 2 + geometry["height"] / 4 * math.cos(t * 4)
+        y = geometry["y"] + geometry["height"] / 2 + geometry["height"] / 4 * math.sin(t * 4)
+        sock.call("stipc/move_cursor", {"x": int(x), "y": int(y)})
+    try:
+        warp_pointer(0)
+    except Exception as e:
+        skip("show-cursor", str(e))
+    else:
+        sock.call("show-cursor/toggle")
+        sock.call("show-cursor/input_latency", {"reset": True})
+        phase("show-cursor", warp_pointer)
+        report["input-latency"] = sock.call("show-cursor/input_latency")
+        sock.call("show-cursor/toggle")
+
+    # Switch through the workspaces of a 3x3 grid, each switch is animated
+    sock.call("ammen99/ipc/set_grid_size", {"width": 3, "height": 3})
+    def switch_workspace(t):
+        index = int(t * 2) % 9
+        sock.call("vswitch/set-workspace", {"x": index % 3, "y": index // 3, "output-id": output["id"]})
+    try:
+        switch_workspace(0.5)
+    except Exception as e:
+        skip("grid", str(e))
+    else:
+        phase("grid", switch_workspace)
+        switch_workspace(0)
+    sock.call("ammen99/ipc/set_grid_size", {"width": 1, "height": 1})
+
+    return report
+
+def check_phases(report):
+    """
+    Every frame which renders goes through all phases, so a phase which stays
+    at zero means that the render hooks did not run in the expected order.
+    """
+    errors = []
+    for name, outputs in report["phases"].items():
+        for o in outputs:
+            if o["timed-frames"] == 0:
+                if o["frames"] > 1:
+                    errors.append(f"{name} {o['output']}: {o['frames']} frames, but none had its phases timed")
+                continue
+            for phase in ("damage", "render", "overlay", "commit"):
+                if o["phases"][phase] <= 0:
+                    errors.append(f"{name} {o['output']}: phase {phase} took no time")
+    return errors
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--wayfire", default="wayfire")
+    parser.add_argument("--plugin-path", required=True, help="directory with the built plugins")
+    parser.add_argument("--metadata-path", required=True, help="directory with the plugins' XML files")
+    parser.add_argument("--clients", type=int, default=4)
+    parser.add_argument("--client-command", default="weston-simple-shm")
+    parser.add_argument("--phase-duration", type=float, default=3)
+    parser.add_argument("--output", help="where to write the JSON report")
+    args = parser.parse_args()
+
+    if not shutil.which(args.client_command.split()[0]):
+        args.clients = 0
+
+    tmpdir = tempfile.mkdtemp(prefix="wf-headless-bench-")
+    config = os.path.join(tmpdir, "wayfire.ini")
+    write_config(config, args)
+
+    env = dict(os.environ)
+    env.update({
+        "WLR_BACKENDS": "headless",
+        "WLR_RENDERER": "pixman",
+        "WLR_HEADLESS_OUTPUTS": "1",
+        "WLR_LIBINPUT_NO_DEVICES": "1",
+        "WAYFIRE_SOCKET": os.path.join(tmpdir, "wayfire.socket"),
+        "WAYFIRE_PLUGIN_PATH": args.plugin_path,
+        "WAYFIRE_PLUGIN_XML_PATH": args.metadata_path,
+        "XDG_RUNTIME_DIR": tmpdir,
+    })
+    env.pop("WAYLAND_DISPLAY", None)
+    env.pop("DISPLAY", None)
+
+    log = open(os.path.join(tmpdir, "wayfire.log"), "w")
+    wayfire = subprocess.Popen([args.wayfire, "-c", config], env=env, stdout=log, stderr=subprocess.STDOUT)
+    clients = []
+    try:
+        wait_for(lambda: (os.path.exists(env["WAYFIRE_SOCKET"]) and find_wayland_display(tmpdir)) or
+                 wayfire.poll() is not None, 10, "the Wayfire sockets")
+        if wayfire.poll() is not None:
+            raise Exception("Wayfire failed to start")
+
+        client_env = dict(env, WAYLAND_DISPLAY=find_wayland_display(tmpdir))
+        report = run_workload(WayfireSocket(env["WAYFIRE_SOCKET"]), args, wayfire, client_env, clients)
+    except Exception as e:
+        # Keep the temporary directory, the log is needed to see what went wrong
+        print(f"Benchmark failed: {e}, see {log.name}", file=sys.stderr)
+        return 1
+    finally:
+        for process in clients + [wayfire]:
+            process.terminate()
+            try:
+                process.wait(5)
+            except subprocess.TimeoutExpired:
+                process.kill()
+        log.close()
+
+    shutil.rmtree(tmpdir, ignore_errors=True)
+
+    for name, outputs in report["phases"].items():
+        for o in outputs:
+            print(f"{name:12} {o['output']}: {o['fps']:.1f} fps, p50 {o['p50']:.2f}ms "
+                  f"p99 {o['p99']:.2f}ms max {o['max']:.2f}ms, {o['over-budget']}/{o['frames']} over budget")
+    for name, reason in report["skipped"].items():
+        print(f"{name:12} skipped: {reason}")
+    if "input-latency" in report:
+        l = report["input-latency"]
+        print(f"input latency: {l['samples']} samples, p50 {l['p50']:.2f}ms p99 {l['p99']:.2f}ms")
+
+    if args.output:
+        with open(args.output, "w") as f:
+            js.dump(report, f, indent=2)
+        print(f"Report written to {args.output}")
+
+    errors = check_phases(report)
+    for error in errors:
+        print(f"Frame phases: {error}", file=sys.stderr)
+
+    return 1 if errors else 0
+
+if __name__ == "__main__":
+    sys.exit(main())
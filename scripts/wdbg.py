@@ -1,10 +1,14 @@
 #!/bin/env python3
 
+import collections
+import select
 import socket
 import json as js
 import os
 import sys
+import time
 import re
+import struct
 from typing import Any, Tuple
 import termcolor
 
@@ -14,15 +18,78 @@ def get_msg_template():
     message["data"] = {}
     return message
 
+def msgpack_decode(data: bytes):
+    # Decode the subset of MessagePack which the plugins send (no ext or bin types)
+    def decode(pos):
+        b = data[pos]
+        pos += 1
+        if b < 0x80:
+            return b, pos
+        if b >= 0xe0:
+            return b - 0x100, pos
+        if b & 0xf0 == 0x80:
+            return decode_map(b & 0x0f, pos)
+        if b & 0xf0 == 0x90:
+            return decode_array(b & 0x0f, pos)
+        if b & 0xe0 == 0xa0:
+            return data[pos:pos + (b & 0x1f)].decode("utf8"), pos + (b & 0x1f)
+        if b in (0xc0, 0xc2, 0xc3):
+            return {0xc0: None, 0xc2: False, 0xc3: True}[b], pos
+        if b == 0xcb:
+            return struct.unpack_from(">d", data, pos)[0], pos + 8
+        if b in INTEGERS:
+            fmt = INTEGERS[b]
+            return struct.unpack_from(fmt, data, pos)[0], pos + struct.calcsize(fmt)
+        if b in (0xd9, 0xda, 0xdb):
+            fmt = {0xd9: ">B", 0xda: ">H", 0xdb: ">I"}[b]
+            n = struct.unpack_from(fmt, data, pos)[0]
+            pos += struct.calcsize(fmt)
+            return data[pos:pos + n].decode("utf8"), pos + n
+        if b in (0xdc, 0xdd, 0xde, 0xdf):
+            fmt = ">H" if b in (0xdc, 0xde) else ">I"
+            n = struct.unpack_from(fmt, data, pos)[0]
+            pos += struct.calcsize(fmt)
+            return decode_array(n, pos) if b in (0xdc, 0xdd) else decode_map(n, pos)
+        raise ValueError(f"unsupported MessagePack type 0x{b:02x}")
+
+    def decode_array(n, pos):
+        result = []
+        for _ in range(n):
+            value, pos = decode(pos)
+            result.append(value)
+        return result, pos
+
+    def decode_map(n, pos):
+        result = {}
+        for _ in range(n):
+            key, pos = decode(pos)
+            result[key], pos = decode(pos)
+        return result, pos
+
+    INTEGERS = {0xcc: ">B", 0xcd: ">H", 0xce: ">I", 0xcf: ">Q", 0xd0: ">b", 0xd1: ">h", 0xd2: ">i", 0xd3: ">q"}
+    return decode(0)[0]
+
+try:
+    # The C implementation is much faster, if it is installed
+    import msgpack
+    msgpack_decode = lambda data: msgpack.unpackb(data, raw=False)
+except ImportError:
+    pass
+
 class WayfireSocket:
     def __init__(self, socket_name):
         self.client = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
         self.client.connect(socket_name)
+        # Events which arrived while waiting for the reply to a method call
+        self.pending_events = collections.deque()
+        # The binary side channel for events, see open_binary_stream()
+        self.binary = None
 
-    def read_exact(self, n):
+    def read_exact(self, n, sock=None):
+        sock = sock or self.client
         response = bytes()
         while n > 0:
-            read_this_time = self.client.recv(n)
+            read_this_time = sock.recv(n)
             if not read_this_time:
                 raise Exception("Failed to read anything from the socket!")
             n -= len(read_this_time)
@@ -30,22 +97,92 @@ class WayfireSocket:
 
         return response
 
-    def read_message(self):
+    def read_socket_message(self):
         rlen = int.from_bytes(self.read_exact(4), byteorder="little")
         response_message = self.read_exact(rlen)
         return js.loads(response_message)
 
+    def read_binary_frame(self):
+        # One MessagePack event from the side channel, still encoded
+        rlen = int.from_bytes(self.read_exact(4, self.binary), byteorder="little")
+        return self.read_exact(rlen, self.binary)
+
+    def read_message(self):
+        # Read the next event or reply, starting with the events queued by send_json
+        if self.pending_events:
+            return self.pending_events.popleft()
+        if self.binary:
+            readable, _, _ = select.select([self.binary, self.client], [], [])
+            if self.binary in readable:
+                return msgpack_decode(self.read_binary_frame())
+        return self.read_socket_message()
+
+    def open_binary_stream(self):
+        # Receive the events of the ammen99 plugins as MessagePack on a second socket
+        response = self.call("ammen99/ipc/binary_stream")
+        self.binary = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.binary.connect(response["path"])
+        self.binary.sendall((response["token"] + "\n").encode("ascii"))
+        return response
+
+    def encoding_bench(self, payload, iterations=1000):
+        message = get_msg_template()
+        message["method"] = "ammen99/ipc/encoding_bench"
+        message["data"] = {"payload": payload, "iterations": iterations}
+        return self.send_json(message)
+
     def send_json(self, msg):
         data = js.dumps(msg).encode('utf8')
         header = len(data).to_bytes(4, byteorder="little")
         self.client.send(header)
         self.client.send(data)
-        return self.read_message()
+        # Subscriptions may send events before the reply, keep them for read_message
+        while True:
+            response = self.read_socket_message()
+            if not (isinstance(response, dict) and "event" in response):
+                return response
+            self.pending_events.append(response)
 
-    def set_debug_filter(self, filter: str):
+    def call(self, method: str, data=None):
+        # Call any method, raising an exception if it returns an error
+        response = self.send_json({"method": method, "data": data or {}})
+        if isinstance(response, dict) and "error" in response:
+            raise Exception(f"{method} failed: {response['error']}")
+        return response
+
+    def set_debug_filter(self, filter: str, **predicates):
         message = get_msg_template()
         message["method"] = "ammen99/debug/filter"
+        message["data"] = predicates
+        message["data"]["filter"] = filter
+        if "ring" in predicates:
+            message["data"]["ring"] = os.path.abspath(predicates["ring"])
+        return self.send_json(message)
+
+    def log_subscribe(self):
+        message = get_msg_template()
+        message["method"] = "ammen99/debug/log_subscribe"
         message["data"] = {}
+        return self.send_json(message)
+
+    def log_gate(self, level: str, categories=None):
+        message = get_msg_template()
+        message["method"] = "ammen99/debug/log_gate"
+        message["data"] = {"level": level}
+        if categories is not None:
+            message["data"]["categories"] = categories
+        return self.send_json(message)
+
+    def log_stats(self, reset=False):
+        message = get_msg_template()
+        message["method"] = "ammen99/debug/log_stats"
+        message["data"] = {"reset": reset}
+        return self.send_json(message)
+
+    def filter_bench(self, filter: str, **predicates):
+        message = get_msg_template()
+        message["method"] = "ammen99/debug/filter_bench"
+        message["data"] = predicates
         message["data"]["filter"] = filter
         return self.send_json(message)
 
@@ -63,10 +200,143 @@ class WayfireSocket:
         message["data"]["height"] = h
         return self.send_json(message)
 
-    def dump_scene(self):
+    def batch(self, calls, stop_on_error=False):
+        # calls is a list of (method, data) pairs, sent in a single request
+        message = get_msg_template()
+        message["method"] = "ammen99/ipc/batch"
+        message["data"] = {"stop_on_error": stop_on_error}
+        message["data"]["calls"] = [{"method": method, "data": data} for method, data in calls]
+        return self.send_json(message)
+
+    def query(self, type="views", fields=None, match=None, columnar=False):
+        message = get_msg_template()
+        message["method"] = "ammen99/ipc/query"
+        message["data"] = {"type": type, "columnar": columnar}
+        if fields is not None:
+            message["data"]["fields"] = fields
+        if match is not None:
+            message["data"]["match"] = match
+        return self.send_json(message)
+
+    def dump_scene(self, root=None, depth=None, since=None):
         message = get_msg_template()
         message["method"] = "ammen99/debug/scenedump"
         message["data"] = {}
+        if root is not None:
+            message["data"]["root"] = root
+        if depth is not None:
+            message["data"]["depth"] = depth
+        if since is not None:
+            message["data"]["since"] = since
+        return self.send_json(message)
+
+    def scene_subscribe(self, enabled=True):
+        message = get_msg_template()
+        message["method"] = "ammen99/debug/scene_subscribe"
+        message["data"] = {"enabled": enabled}
+        return self.send_json(message)
+
+    def dump_scene_streamed(self, root=None, depth=None):
+        message = get_msg_template()
+        message["method"] = "ammen99/debug/scenedump"
+        message["data"] = {"stream": True}
+        if root is not None:
+            message["data"]["root"] = root
+        if depth is not None:
+            message["data"]["depth"] = depth
+        response = self.send_json(message)
+        if "error" in response:
+            return response
+
+        chunks = []
+        while True:
+            msg = self.read_message()
+            if msg.get("event") != "ammen99/debug/scenedump" or msg["stream"] != response["stream"]:
+                continue
+            chunks.append(msg["data"])
+            if msg["done"]:
+                break
+
+        scene = js.loads("".join(chunks))
+        if scene is None:
+            return {"error": "the node was removed"}
+        scene["scene-generation"] = response["scene-generation"]
+        return scene
+
+    def render_profile(self, enable=None, reset=False):
+        message = get_msg_template()
+        message["method"] = "ammen99/debug/render_profile"
+        message["data"] = {}
+        if enable is not None:
+            message["data"]["enable"] = enable
+        message["data"]["reset"] = reset
+        return self.send_json(message)
+
+    def damage_stats(self, enable=None, heatmap=False, reset=False):
+        message = get_msg_template()
+        message["method"] = "ammen99/debug/damage_stats"
+        message["data"] = {}
+        if enable is not None:
+            message["data"]["enable"] = enable
+            message["data"]["heatmap"] = heatmap
+        message["data"]["reset"] = reset
+        return self.send_json(message)
+
+    def bench_stats(self):
+        message = get_msg_template()
+        message["method"] = "ammen99/bench/stats"
+        message["data"] = {}
+        return self.send_json(message)
+
+    def bench_watch(self):
+        message = get_msg_template()
+        message["method"] = "ammen99/bench/watch"
+        message["data"] = {}
+        return self.send_json(message)
+
+    def bench_save_baseline(self, path: str, name=None):
+        message = get_msg_template()
+        message["method"] = "ammen99/bench/save_baseline"
+        message["data"] = {}
+        message["data"]["path"] = os.path.abspath(path)
+        if name is not None:
+            message["data"]["name"] = name
+        return self.send_json(message)
+
+    def bench_compare(self, path: str, tolerance: float):
+        message = get_msg_template()
+        message["method"] = "ammen99/bench/compare"
+        message["data"] = {}
+        message["data"]["path"] = os.path.abspath(path)
+        message["data"]["tolerance"] = tolerance
+        return self.send_json(message)
+
+    def bench_stress(self, action: str, **kwargs):
+        message = get_msg_template()
+        message["method"] = "ammen99/bench/stress"
+        message["data"] = kwargs
+        message["data"]["action"] = action
+        return self.send_json(message)
+
+    def input_latency(self, reset: bool):
+        message = get_msg_template()
+        message["method"] = "show-cursor/input_latency"
+        message["data"] = {}
+        message["data"]["reset"] = reset
+        return self.send_json(message)
+
+    def trace_start(self, path: str, capacity: int):
+        message = get_msg_template()
+        message["method"] = "ammen99/debug/trace_start"
+        message["data"] = {}
+        message["data"]["path"] = os.path.abspath(path)
+        message["data"]["capacity"] = capacity
+        return self.send_json(message)
+
+    def trace_stop(self):
+        message = get_msg_template()
+        message["method"] = "ammen99/debug/trace_stop"
+        message["data"] = {}
         return self.send_json(message)
 
 def highlight_for_node(name: str) -> Tuple[Any, Any]:
@@ -89,7 +359,18 @@ def highlight_for_node(name: str) -> Tuple[Any, Any]:
 
 highlight_nodes = ['view-root-node', 'workspace-set', 'layer_']
 
-def print_scene(root, depth=0, disabled=False):
+def print_scene_diff(diff):
+    if not diff["complete"]:
+        print("Too many changes, some removals are missing")
+    for node in diff["changed"]:
+        b = node["local-bbox"]
+        print(f"[{diff['generation']}] {node['name']} id={node['id']} parent={node['parent']} "
+              f"geometry=({b['x']},{b['y']} {b['width']}x{b['height']}) enabled={node['enabled']} "
+              f"children={node['children']} changes={','.join(node['changes'])}")
+    for id in diff["removed"]:
+        print(f"[{diff['generation']}] removed id={id}")
+
+def print_scene(root, depth=0, disabled=False, by_cost=False):
     name = root["name"]
     if re.search(r'\([^)]*d[^)]*\)', name):
         disabled = True
@@ -105,6 +386,8 @@ def print_scene(root, depth=0, disabled=False):
         prefix = prefix[:-1] + '-'
 
     string = f"{name} id={id} geometry=({x},{y} {w}x{h})"
+    if "cost-per-frame" in root:
+        string += f" cost={root['cost-per-frame']:.3f}ms/frame total={root['cost-total']:.1f}ms"
 
     if disabled:
         _, attrs = highlight_for_node(name)
@@ -116,20 +399,324 @@ def print_scene(root, depth=0, disabled=False):
         else:
             print(prefix + termcolor.colored(string, attrs=attrs))
 
-    for ch in root["children"]:
-        print_scene(ch, depth+1, disabled)
+    # Nodes removed while the scene was streamed are null
+    children = [ch for ch in root["children"] if ch is not None]
+    if by_cost:
+        children = sorted(children, key=lambda ch: ch["cost-per-frame"], reverse=True)
 
-addr = os.getenv('WAYFIRE_SOCKET')
-wsocket = WayfireSocket(addr)
+    for ch in children:
+        print_scene(ch, depth+1, disabled, by_cost)
 
-if sys.argv[1] == "dump-scenegraph":
-    print_scene(wsocket.dump_scene())
-elif sys.argv[1] == "start-log":
-    wsocket.set_debug_filter(sys.argv[2])
-elif sys.argv[1] == "stop-log":
-    wsocket.stop_log()
-elif sys.argv[1] == "set-grid":
-    wsocket.set_grid(int(sys.argv[2]), int(sys.argv[3]))
-else:
-    print("Unknown command!")
+# See src/trace.hpp for the format of trace files
+TRACE_HEADER = struct.Struct("<8sIIQQ32x")
+TRACE_RECORD = struct.Struct("<QHBxIQ")
+TRACE_MAX_NAMES = 256
+TRACE_NAME_SIZE = 48
+
+def export_chrome_trace(trace_path: str, json_path: str):
+    with open(trace_path, "rb") as f:
+        data = f.read()
+
+    magic, version, record_size, capacity, count = TRACE_HEADER.unpack_from(data, 0)
+    if magic != b"WFTRACE1" or version != 1 or record_size != TRACE_RECORD.size:
+        raise Exception(f"{trace_path} is not a supported trace file")
+
+    names = []
+    offset = TRACE_HEADER.size
+    for i in range(TRACE_MAX_NAMES):
+        raw = data[offset + i * TRACE_NAME_SIZE:offset + (i + 1) * TRACE_NAME_SIZE]
+        names.append(raw.split(b"\0", 1)[0].decode("utf8"))
+
+    # The oldest records are overwritten once the ring is full
+    offset += TRACE_MAX_NAMES * TRACE_NAME_SIZE
+    first = max(0, count - capacity)
+    events = []
+    for i in range(first, count):
+        ts, name, phase, track, arg = TRACE_RECORD.unpack_from(data, offset + (i % capacity) * TRACE_RECORD.size)
+        event = {"name": names[name], "ph": chr(phase), "ts": ts / 1000.0, "pid": 1, "tid": track}
+        if chr(phase) == "i":
+            event["s"] = "t"
+        if arg:
+            event["args"] = {"arg": arg}
+        events.append(event)
+
+    with open(json_path, "w") as f:
+        js.dump({"traceEvents": events, "displayTimeUnit": "ms"}, f)
+
+    print(f"Exported {len(events)} events ({count - len(events)} overwritten) to {json_path}")
+
+# See src/log-ring.hpp for the format of log ring files
+LOG_RING_HEADER = struct.Struct("<8sIIQQ32x")
+
+def dump_log_ring(path: str):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    magic, version, _, capacity, written = LOG_RING_HEADER.unpack_from(data, 0)
+    if magic != b"WFLOGRNG" or version != 1:
+        raise Exception(f"{path} is not a supported log ring file")
+
+    ring = data[LOG_RING_HEADER.size:LOG_RING_HEADER.size + capacity]
+    if written <= capacity:
+        text = ring[:written]
+    else:
+        # Skip the partially overwritten oldest line
+        start = written % capacity
+        text = ring[start:] + ring[:start]
+        text = text[text.find(b"\n") + 1:]
+
+    sys.stdout.write(text.decode("utf8", errors="replace"))
+
+def print_bench_stats(outputs):
+    for o in outputs:
+        print(f"{o['output']}: {o['fps']:.1f} fps, frame time (ms) min {o['min']:.2f} p50 {o['p50']:.2f} "
+              f"p95 {o['p95']:.2f} p99 {o['p99']:.2f} max {o['max']:.2f}, "
+              f"{o['over-budget']}/{o['frames']} over budget, {o.get('idle-gaps', 0)} idle gaps")
+        phases = ", ".join(f"{name} {ms:.2f}" for name, ms in o['phases'].items())
+        print(f"    phases (ms): {phases}")
+        if "presentation" in o:
+            p = o["presentation"]
+            print(f"    latency (ms): p50 {p['latency-p50']:.2f} p99 {p['latency-p99']:.2f} "
+                  f"max {p['latency-max']:.2f}, refresh {p['refresh']:.2f}ms, "
+                  f"{p['missed-vblanks']} missed vblanks, {p['discarded']} discarded")
+
+def print_bench_comparison(result):
+    status = lambda ok: termcolor.colored("pass", "green") if ok else termcolor.colored("FAIL", "red", attrs=["bold"])
+    print(f"Baseline {result['baseline']}, tolerance {result['tolerance'] * 100:.0f}%: {status(result['pass'])}")
+    for o in result["outputs"]:
+        print(f"{o['output']}: {status(o['pass'])}")
+        for name, m in o["metrics"].items():
+            print(f"    {name:16} {m['baseline']:8.3f} -> {m['current']:8.3f} "
+                  f"({m['delta']:+.3f}, {m['relative'] * 100:+.1f}%) {status(m['pass'])}")
+    for name in result["unmatched"]:
+        print(f"{name}: no baseline")
+
+def main():
+    if sys.argv[1] == "trace-export":
+        export_chrome_trace(sys.argv[2], sys.argv[3])
+        sys.exit(0)
+
+    if sys.argv[1] == "log-dump":
+        dump_log_ring(sys.argv[2])
+        sys.exit(0)
+
+    addr = os.getenv('WAYFIRE_SOCKET')
+    wsocket = WayfireSocket(addr)
+    if "--binary" in sys.argv:
+        # Streamed events (log-follow, scene-watch, bench-watch) arrive as MessagePack
+        sys.argv.remove("--binary")
+        wsocket.open_binary_stream()
+
+    if sys.argv[1] == "dump-scenegraph":
+        # Options: --by-cost, or --root ID and --depth N
+        opts = dict(zip(sys.argv[2::2], sys.argv[3::2]))
+        if len(sys.argv) > 2 and sys.argv[2] == "--by-cost":
+            print_scene(wsocket.render_profile()["scene"], by_cost=True)
+        else:
+            root = int(opts["--root"]) if "--root" in opts else None
+            depth = int(opts["--depth"]) if "--depth" in opts else None
+            scene = wsocket.dump_scene_streamed(root, depth)
+            if "error" in scene:
+                print(scene["error"])
+                sys.exit(1)
+            print_scene(scene)
+            print(f"generation {scene['scene-generation']}")
+    elif sys.argv[1] == "scene-changes":
+        # Print the nodes which changed after the given generation, then follow further changes
+        since = int(sys.argv[2]) if len(sys.argv) > 2 else 0
+        while True:
+            diff = wsocket.dump_scene(since=since)
+            print_scene_diff(diff)
+            since = diff["generation"]
+            time.sleep(0.5)
+    elif sys.argv[1] == "scene-watch":
+        # Like scene-changes, but Wayfire pushes the changes at most once per frame
+        print(f"Subscribed at generation {wsocket.scene_subscribe()['generation']}")
+        while True:
+            msg = wsocket.read_message()
+            if msg.get("event") == "ammen99/debug/scene-changes":
+                print_scene_diff(msg)
+    elif sys.argv[1] == "render-profile":
+        if sys.argv[2] == "start":
+            wsocket.render_profile(enable=True, reset=True)
+        elif sys.argv[2] == "stop":
+            wsocket.render_profile(enable=False)
+        elif sys.argv[2] == "reset":
+            wsocket.render_profile(reset=True)
+    elif sys.argv[1] == "start-log":
+        # Optional predicates: level=info file=view category=TXN
+        print(wsocket.set_debug_filter(sys.argv[2], **dict(arg.split("=", 1) for arg in sys.argv[3:])))
+    elif sys.argv[1] == "log-follow":
+        # Like start-log, but stream the lines here instead of to Wayfire's stdout
+        predicates = dict(arg.split("=", 1) for arg in sys.argv[3:])
+        predicates.setdefault("stdout", False)
+        wsocket.set_debug_filter(sys.argv[2], **predicates)
+        wsocket.log_subscribe()
+        try:
+            while True:
+                msg = wsocket.read_message()
+                if msg.get("event") != "ammen99/debug/log":
+                    continue
+                for line in msg["lines"]:
+                    print(line)
+                if msg["dropped"]:
+                    print(f"... {msg['dropped']} lines dropped")
+        except KeyboardInterrupt:
+            wsocket.stop_log()
+    elif sys.argv[1] == "log-gate":
+        categories = sys.argv[3].split(",") if len(sys.argv) > 3 else None
+        print(wsocket.log_gate(sys.argv[2], categories))
+    elif sys.argv[1] == "log-stats":
+        print(wsocket.log_stats(len(sys.argv) > 2 and sys.argv[2] == "reset"))
+    elif sys.argv[1] == "log-overhead":
+        # Measure the frame times at each verbosity, with the bench plugin loaded
+        seconds = float(sys.argv[2]) if len(sys.argv) > 2 else 5
+        filter = sys.argv[3] if len(sys.argv) > 3 else ".*"
+        levels = [("quiet", "error", []), ("info", "info", []), ("debug", "debug", []), ("debug+all", "debug", None)]
+        wsocket.set_debug_filter(filter, stdout=False, level="error", categories=[])
+        try:
+            for name, level, categories in levels:
+                wsocket.log_gate(level, categories)
+                wsocket.log_stats(reset=True)
+                time.sleep(seconds)
+                stats = wsocket.log_stats()
+                line = f"{name:10} {stats['lines-per-second']:10.0f} lines/s, sink {stats['sink-ms'] / stats['elapsed']:6.2f} ms/s"
+                bench = wsocket.bench_stats()
+                for o in bench.get("outputs", []):
+                    line += f" | {o['output']}: {o['fps']:.1f} fps, mean {o['mean']:.2f}ms p99 {o['p99']:.2f}ms"
+                print(line)
+        finally:
+            wsocket.stop_log()
+    elif sys.argv[1] == "filter-bench":
+        result = wsocket.filter_bench(sys.argv[2], **dict(arg.split("=", 1) for arg in sys.argv[3:]))
+        if "error" in result:
+            print(result["error"])
+            sys.exit(1)
+        print(f"{result['lines']} lines, prefilter {result['prefilter']}, regex {'needed' if result['uses-regex'] else 'skipped'}")
+        for name in ["filter", "regex"]:
+            print(f"{name:8} {result[name]['lines-per-second']:14.0f} lines/s, {result[name]['matched']} matched")
+    elif sys.argv[1] == "stop-log":
+        wsocket.stop_log()
+    elif sys.argv[1] == "set-grid":
+        wsocket.set_grid(int(sys.argv[2]), int(sys.argv[3]))
+    elif sys.argv[1] == "batch":
+        # Read a JSON list of {"method", "data"} objects from a file or stdin and run them in one request
+        paths = [arg for arg in sys.argv[2:] if not arg.startswith("--")]
+        with (open(paths[0]) if paths else sys.stdin) as f:
+            calls = [(call["method"], call.get("data", {})) for call in js.load(f)]
+        result = wsocket.batch(calls, stop_on_error="--stop-on-error" in sys.argv)
+        if "error" in result:
+            print(result["error"])
+            sys.exit(1)
+        for call, response in zip(calls, result["results"]):
+            print(f"{call[0]}: {js.dumps(response)}")
+    elif sys.argv[1] == "query":
+        # Options: views|outputs, --fields a,b,c, --match EXPR, --columnar
+        type = sys.argv[2] if len(sys.argv) > 2 and not sys.argv[2].startswith("--") else "views"
+        opts = dict(zip(sys.argv[2:], sys.argv[3:]))
+        fields = opts["--fields"].split(",") if "--fields" in opts else None
+        result = wsocket.query(type, fields, opts.get("--match"), "--columnar" in sys.argv)
+        if "error" in result:
+            print(result["error"])
+            sys.exit(1)
+        if "columns" in result:
+            # Transpose back into one line per object
+            for row in zip(*result["columns"]):
+                print(" ".join(f"{name}={js.dumps(value)}" for name, value in zip(result["fields"], row)))
+        else:
+            for item in result["items"]:
+                print(" ".join(f"{name}={js.dumps(value)}" for name, value in item.items()))
+    elif sys.argv[1] == "encoding-bench":
+        # Compare JSON and MessagePack on messages like the ones the plugins stream
+        iterations = int(sys.argv[2]) if len(sys.argv) > 2 else 1000
+        if not wsocket.binary:
+            wsocket.open_binary_stream()
+        samples = {
+            "bench-stats": lambda: {"event": "ammen99/bench/stats", "outputs": wsocket.bench_stats()["outputs"]},
+            "scene": lambda: wsocket.dump_scene(),
+            "query": lambda: wsocket.query(columnar=True),
+        }
+        for name, get_sample in samples.items():
+            payload = get_sample()
+            if "error" in payload:
+                print(f"{name}: {payload['error']}")
+                continue
+            result = wsocket.encoding_bench(payload, iterations)
+            frame = wsocket.read_binary_frame()
+            text = js.dumps({"event": "ammen99/ipc/encoding-bench", "payload": payload})
+
+            start = time.perf_counter()
+            for _ in range(iterations):
+                decoded_json = js.loads(text)
+            json_us = (time.perf_counter() - start) * 1e6 / iterations
+
+            start = time.perf_counter()
+            for _ in range(iterations):
+                decoded_msgpack = msgpack_decode(frame)
+            msgpack_us = (time.perf_counter() - start) * 1e6 / iterations
+
+            # Doubles are compared exactly, both encodings keep all of their bits
+            status = "ok" if decoded_json == decoded_msgpack else "MISMATCH"
+            print(f"{name}: {status}")
+            for encoding, decode_us in [("json", json_us), ("msgpack", msgpack_us)]:
+                r = result[encoding]
+                print(f"  {encoding:8} {r['bytes']:8} bytes, encode {r['us-per-message']:9.2f} us "
+                      f"({r['mb-per-second']:8.1f} MB/s), decode {decode_us:9.2f} us")
+    elif sys.argv[1] == "bench-stats":
+        print_bench_stats(wsocket.bench_stats()["outputs"])
+    elif sys.argv[1] == "bench-watch":
+        wsocket.bench_watch()
+        while True:
+            print_bench_stats(wsocket.read_message()["outputs"])
+    elif sys.argv[1] == "bench-baseline":
+        print(wsocket.bench_save_baseline(sys.argv[2], sys.argv[3] if len(sys.argv) > 3 else None))
+    elif sys.argv[1] == "bench-compare":
+        result = wsocket.bench_compare(sys.argv[2], float(sys.argv[3]) if len(sys.argv) > 3 else 0.1)
+        if "error" in result:
+            print(result["error"])
+            sys.exit(2)
+        print_bench_comparison(result)
+        sys.exit(0 if result["pass"] else 1)
+    elif sys.argv[1] == "bench-stress":
+        cmd = sys.argv[2] if len(sys.argv) > 2 else "status"
+        if cmd == "start":
+            pattern = sys.argv[3] if len(sys.argv) > 3 else "moving"
+            count = int(sys.argv[4]) if len(sys.argv) > 4 else 16
+            wsocket.bench_stress("start", pattern=pattern, count=count)
+            # Wait for the ramp on every output to finish
+            while any(o["running"] and o["ramping"] for o in wsocket.bench_stress("status")["outputs"]):
+                time.sleep(1)
+            cmd = "status"
+
+        for o in wsocket.bench_stress(cmd)["outputs"]:
+            state = f"running {o['pattern']} with {o['load']} quads" if o["running"] else "stopped"
+            print(f"{o['output']}: {state}, maximum sustainable load {o['max-sustained']} quads")
+    elif sys.argv[1] == "trace-start":
+        capacity = int(sys.argv[3]) if len(sys.argv) > 3 else 1 << 20
+        print(wsocket.trace_start(sys.argv[2], capacity))
+    elif sys.argv[1] == "trace-stop":
+        print(wsocket.trace_stop())
+    elif sys.argv[1] == "damage-stats":
+        cmd = sys.argv[2] if len(sys.argv) > 2 else "show"
+        if cmd == "start":
+            stats = wsocket.damage_stats(enable=True, reset=True)
+        elif cmd == "heatmap":
+            stats = wsocket.damage_stats(enable=True, heatmap=True, reset=True)
+        elif cmd == "stop":
+            stats = wsocket.damage_stats(enable=False)
+        else:
+            stats = wsocket.damage_stats(reset=(cmd == "reset"))
+
+        for o in stats["outputs"]:
+            print(f"{o['output']}: {o['frames']} frames ({o['full-frames']} full), mean damage {o['mean-area']:.0f}px "
+                  f"in {o['mean-rects']:.1f} rects, {o['mean-ratio'] * 100:.1f}% of the output "
+                  f"(max {o['max-ratio'] * 100:.1f}%)")
+    elif sys.argv[1] == "input-latency":
+        lat = wsocket.input_latency(len(sys.argv) > 2 and sys.argv[2] == "reset")
+        print(f"{lat['samples']} samples, input to present (ms) mean {lat['mean']:.2f} p50 {lat['p50']:.2f} "
+              f"p95 {lat['p95']:.2f} p99 {lat['p99']:.2f} max {lat['max']:.2f}")
+    else:
+        print("Unknown command!")
 
+if __name__ == "__main__":
+    main()
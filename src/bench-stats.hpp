@@ -0,0 +1,726 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <vector>
+
+namespace wf
+{
+namespace bench
+{
+/** The time on the monotonic clock, which wlroots uses for present events. */
+inline uint64_t get_current_time_ns()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+inline uint64_t get_current_time_us()
+{
+    return get_current_time_ns() / 1000;
+}
+
+inline uint64_t timespec_to_us(const timespec *ts)
+{
+    return ts ? ts->tv_sec * 1'000'000ull + ts->tv_nsec / 1000 : 0;
+}
+
+// wlroots changed wlr_output_event_present::when from a pointer to a value
+inline uint64_t timespec_to_us(const timespec& ts)
+{
+    return timespec_to_us(&ts);
+}
+
+/**
+ * A histogram of frame intervals (in microseconds) with logarithmic buckets.
+ *
+ * Values below SUB_COUNT are stored exactly. Larger values are split into
+ * SUB_COUNT linear sub-buckets per power of two, so the relative error of a
+ * bucket is at most 1 / SUB_COUNT (~6%) over the whole range (up to ~16s).
+ */
+class frame_histogram_t
+{
+  public:
+    static constexpr int SUB_BITS  = 4;
+    static constexpr int SUB_COUNT = 1 << SUB_BITS;
+    static constexpr int MAX_EXP   = 24;
+    static constexpr int BUCKETS   = (MAX_EXP - SUB_BITS + 2) * SUB_COUNT;
+
+    static int bucket_of(uint64_t us)
+    {
+        if (us < SUB_COUNT)
+        {
+            return us;
+        }
+
+        int e = 63 - __builtin_clzll(us);
+        if (e > MAX_EXP)
+        {
+            return BUCKETS - 1;
+        }
+
+        int sub = (us >> (e - SUB_BITS)) & (SUB_COUNT - 1);
+        return (e - SUB_BITS + 1) * SUB_COUNT + sub;
+    }
+
+    /** The smallest value which falls into the given bucket. */
+    static uint64_t bucket_lower(int idx)
+    {
+        if (idx < SUB_COUNT)
+        {
+            return idx;
+        }
+
+        int e   = idx / SUB_COUNT + SUB_BITS - 1;
+        int sub = idx % SUB_COUNT;
+        return uint64_t(SUB_COUNT + sub) << (e - SUB_BITS);
+    }
+
+    /** The value used to represent all samples in the given bucket. */
+    static uint64_t bucket_value(int idx)
+    {
+        if (idx < SUB_COUNT)
+        {
+            return idx;
+        }
+
+        int e = idx / SUB_COUNT + SUB_BITS - 1;
+        return bucket_lower(idx) + (uint64_t(1) << (e - SUB_BITS)) / 2;
+    }
+
+    void add(uint64_t us)
+    {
+        ++buckets[bucket_of(us)];
+        ++count;
+    }
+
+    void remove(uint64_t us)
+    {
+        --buckets[bucket_of(us)];
+        --count;
+    }
+
+    void clear()
+    {
+        buckets.fill(0);
+        count = 0;
+    }
+
+    uint64_t size() const
+    {
+        return count;
+    }
+
+    /** Get the value at the given quantile (0..1), or 0 if the histogram is empty. */
+    uint64_t quantile(double q) const
+    {
+        if (count == 0)
+        {
+            return 0;
+        }
+
+        uint64_t target = std::max<uint64_t>(1, std::min<uint64_t>(count, q * count + 0.5));
+        uint64_t seen   = 0;
+        for (int i = 0; i < BUCKETS; i++)
+        {
+            seen += buckets[i];
+            if (seen >= target)
+            {
+                return bucket_value(i);
+            }
+        }
+
+        return bucket_value(BUCKETS - 1);
+    }
+
+  private:
+    std::array<uint32_t, BUCKETS> buckets{};
+    uint64_t count = 0;
+};
+
+/** The phases of a frame, as seen from the render hooks and output events. */
+enum frame_phase_t
+{
+    // From the output's frame event until the repaint starts
+    PHASE_WAIT    = 0,
+    // Running pre hooks, collecting damage and running damage hooks
+    PHASE_DAMAGE  = 1,
+    // Rendering the scene
+    PHASE_RENDER  = 2,
+    // Running overlay hooks until the output commit starts
+    PHASE_OVERLAY = 3,
+    // Committing the output state
+    PHASE_COMMIT  = 4,
+    PHASE_COUNT   = 5,
+};
+
+static constexpr const char *phase_names[PHASE_COUNT] = {
+    "wait", "damage", "render", "overlay", "commit"
+};
+
+using frame_phases_t = std::array<uint64_t, PHASE_COUNT>;
+
+/** A summary of the frame intervals in the current window, times are in milliseconds. */
+struct frame_summary_t
+{
+    double fps = 0;
+    uint64_t frames = 0;
+    double min = 0;
+    double p50 = 0;
+    double p95 = 0;
+    double p99 = 0;
+    double max = 0;
+    double mean = 0;
+    double budget = 0;
+    uint64_t over_budget = 0;
+    // Average time spent in the bench hooks per frame, in microseconds
+    double overhead = 0;
+    // Average duration of each phase of the frames which completed all phases
+    std::array<double, PHASE_COUNT> phases{};
+    uint64_t timed_frames = 0;
+    // Gaps which were idle time, not counted as intervals
+    uint64_t idle_gaps = 0;
+};
+
+/**
+ * A fixed-capacity FIFO which never allocates after construction.
+ * When full, pushing a new element drops the oldest one.
+ */
+template<class T>
+class ring_buffer_t
+{
+  public:
+    ring_buffer_t(size_t capacity = 0) : data(std::max<size_t>(capacity, 1))
+    {}
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    size_t capacity() const
+    {
+        return data.size();
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    bool full() const
+    {
+        return count == data.size();
+    }
+
+    T& front()
+    {
+        return data[head];
+    }
+
+    T& back()
+    {
+        return (*this)[count - 1];
+    }
+
+    T& operator [](size_t i)
+    {
+        size_t idx = head + i;
+        return data[idx >= data.size() ? idx - data.size() : idx];
+    }
+
+    const T& operator [](size_t i) const
+    {
+        return const_cast<ring_buffer_t&>(*this)[i];
+    }
+
+    /** Push a new element at the back. The buffer must not be full. */
+    void push_back(const T& value)
+    {
+        ++count;
+        back() = value;
+    }
+
+    void pop_front()
+    {
+        head = (head + 1 == data.size()) ? 0 : head + 1;
+        --count;
+    }
+
+    void pop_back()
+    {
+        --count;
+    }
+
+  private:
+    std::vector<T> data;
+    size_t head  = 0;
+    size_t count = 0;
+};
+
+/**
+ * The minimum or maximum of the values in a sliding window, where values leave
+ * in the order they were added. The candidates are kept in a monotonic queue,
+ * so adding a value is amortized O(1) and removing one or reading the extreme
+ * is O(1).
+ *
+ * @tparam Compare std::less for the minimum, std::greater for the maximum.
+ */
+template<class Compare>
+class sliding_extreme_t
+{
+  public:
+    /** @capacity The highest number of values in the window at once. */
+    sliding_extreme_t(size_t capacity = 0) : candidates(capacity)
+    {}
+
+    /** Add the value with the sequence number @seq, which must be higher than all before. */
+    void push(uint64_t seq, uint64_t value)
+    {
+        // Values which can no longer be the extreme while @value is in the window
+        while (!candidates.empty() && !Compare{}(candidates.back().value, value))
+        {
+            candidates.pop_back();
+        }
+
+        candidates.push_back({seq, value});
+    }
+
+    /** Remove the value with the sequence number @seq, the oldest in the window. */
+    void remove(uint64_t seq)
+    {
+        if (!candidates.empty() && (candidates.front().seq == seq))
+        {
+            candidates.pop_front();
+        }
+    }
+
+    /** The extreme of the window, or 0 if it is empty. */
+    uint64_t get() const
+    {
+        return candidates.empty() ? 0 : candidates[0].value;
+    }
+
+  private:
+    struct candidate_t
+    {
+        uint64_t seq;
+        uint64_t value;
+    };
+
+    ring_buffer_t<candidate_t> candidates;
+};
+
+/**
+ * Keeps the frames from the last few seconds and a histogram of the intervals
+ * between them.
+ *
+ * The frames are stored in a preallocated ring buffer together with running
+ * sums and the minimum and maximum interval, so that recording a frame does
+ * not allocate and is O(1), and summarizing does not scan the frames.
+ */
+class frame_window_t
+{
+  public:
+    /** The highest frame rate which the window can hold without dropping frames. */
+    static constexpr double MAX_FPS = 1000;
+
+    frame_window_t(double window_seconds = 1) : frames(window_seconds * MAX_FPS + 1),
+        min_interval(frames.capacity()), max_interval(frames.capacity())
+    {}
+
+    /**
+     * Gaps between frames longer than this are considered idle time rather
+     * than slow frames if nothing was waiting to be drawn when the gap started.
+     * Such gaps are not recorded as intervals, only counted.
+     */
+    static constexpr uint64_t IDLE_GAP_US = 500'000;
+
+    /** Set the refresh interval of the output, used to count late frames. */
+    void set_budget(uint64_t budget_us)
+    {
+        this->budget_us = budget_us;
+    }
+
+    /**
+     * Record a new frame.
+     *
+     * @param redraw_pending Whether a redraw was already pending when the
+     *   previous frame ended. A long gap after such a frame is a stall and is
+     *   recorded like any other interval.
+     * @return The interval since the previous frame, or 0 if there was none.
+     */
+    uint64_t push(uint64_t now_us, bool redraw_pending)
+    {
+        if (frames.full())
+        {
+            drop_oldest();
+        }
+
+        uint64_t interval = 0;
+        bool late = false;
+        bool idle = last_frame && !redraw_pending && (now_us - last_frame >= IDLE_GAP_US);
+        if (last_frame && !idle)
+        {
+            interval = now_us - last_frame;
+            late     = is_late(interval);
+            histogram.add(interval);
+            min_interval.push(next_seq, interval);
+            max_interval.push(next_seq, interval);
+            over_budget  += late;
+            interval_sum += interval;
+        }
+
+        frames.push_back({next_seq++, now_us, interval, 0, {}, false, late, idle});
+        idle_gaps += idle;
+        last_frame = now_us;
+        return interval;
+    }
+
+    /** Account time spent by the bench plugin itself to the last frame. */
+    void add_overhead(uint64_t ns)
+    {
+        if (!frames.empty())
+        {
+            frames.back().overhead += ns;
+            overhead_sum += ns;
+        }
+    }
+
+    /** Set the duration of each phase (in nanoseconds) of the last frame. */
+    void set_phases(const frame_phases_t& phases)
+    {
+        if (frames.empty() || frames.back().timed)
+        {
+            return;
+        }
+
+        auto& f = frames.back();
+        f.phases = phases;
+        f.timed  = true;
+        for (int i = 0; i < PHASE_COUNT; i++)
+        {
+            phase_sums[i] += phases[i];
+        }
+
+        ++timed_frames;
+    }
+
+    /** Remove all frames older than @oldest_allowed. */
+    void expire(uint64_t oldest_allowed)
+    {
+        while (!frames.empty() && (frames.front().time < oldest_allowed))
+        {
+            drop_oldest();
+        }
+    }
+
+    frame_summary_t summarize(double window_seconds) const
+    {
+        frame_summary_t s;
+        s.frames = frames.size();
+        s.fps    = frames.size() / window_seconds;
+        s.budget = budget_us / 1000.0;
+        s.over_budget = over_budget;
+        s.overhead    = frames.empty() ? 0 : overhead_sum / 1000.0 / frames.size();
+        s.timed_frames = timed_frames;
+        s.idle_gaps    = idle_gaps;
+        for (int i = 0; (i < PHASE_COUNT) && timed_frames; i++)
+        {
+            s.phases[i] = phase_sums[i] / 1e6 / timed_frames;
+        }
+
+        if (histogram.size() == 0)
+        {
+            return s;
+        }
+
+        s.min  = min_interval.get() / 1000.0;
+        s.max  = max_interval.get() / 1000.0;
+        s.mean = interval_sum / 1000.0 / histogram.size();
+        s.p50 = histogram.quantile(0.50) / 1000.0;
+        s.p95 = histogram.quantile(0.95) / 1000.0;
+        s.p99 = histogram.quantile(0.99) / 1000.0;
+        return s;
+    }
+
+  private:
+    struct frame_t
+    {
+        uint64_t seq;
+        uint64_t time;
+        // Time since the previous frame, or 0 for the first frame and after idle gaps
+        uint64_t interval;
+        // Nanoseconds spent in the bench hooks during this frame
+        uint64_t overhead;
+        frame_phases_t phases;
+        bool timed;
+        // Whether the frame was late against the budget at the time it was pushed
+        bool late;
+        // Whether the frame ended an idle gap, see IDLE_GAP_US
+        bool after_idle;
+    };
+
+    void drop_oldest()
+    {
+        auto& f = frames.front();
+        if (f.interval)
+        {
+            histogram.remove(f.interval);
+            min_interval.remove(f.seq);
+            max_interval.remove(f.seq);
+            over_budget  -= f.late;
+            interval_sum -= f.interval;
+        }
+
+        overhead_sum -= f.overhead;
+        idle_gaps    -= f.after_idle;
+        if (f.timed)
+        {
+            for (int i = 0; i < PHASE_COUNT; i++)
+            {
+                phase_sums[i] -= f.phases[i];
+            }
+
+            --timed_frames;
+        }
+
+        frames.pop_front();
+    }
+
+    bool is_late(uint64_t interval) const
+    {
+        // Allow for some jitter: a frame is late if it missed (at least) one vblank.
+        return budget_us && (interval * 2 > budget_us * 3);
+    }
+
+    ring_buffer_t<frame_t> frames;
+    frame_histogram_t histogram;
+    sliding_extreme_t<std::less<uint64_t>> min_interval;
+    sliding_extreme_t<std::greater<uint64_t>> max_interval;
+    uint64_t next_seq     = 0;
+    uint64_t last_frame   = 0;
+    uint64_t budget_us    = 0;
+    uint64_t over_budget  = 0;
+    uint64_t interval_sum = 0;
+    uint64_t overhead_sum = 0;
+    frame_phases_t phase_sums{};
+    uint64_t timed_frames = 0;
+    uint64_t idle_gaps    = 0;
+};
+
+/** A summary of the presentation feedback in the current window, times are in milliseconds. */
+struct present_summary_t
+{
+    uint64_t presented = 0;
+    uint64_t discarded = 0;
+    uint64_t missed_vblanks = 0;
+    double latency_p50 = 0;
+    double latency_p99 = 0;
+    double latency_max = 0;
+    double refresh = 0;
+};
+
+/**
+ * Keeps the presentation events of an output from the last few seconds:
+ * the latency from commit to present, the interval between presents and the
+ * number of vblanks which were missed.
+ */
+class present_window_t
+{
+  public:
+    present_window_t(double window_seconds = 1) :
+        events(window_seconds * frame_window_t::MAX_FPS + 1), max_latency(events.capacity())
+    {}
+
+    /**
+     * Record a present event.
+     *
+     * A late frame still lands on the first vblank after its commit, so missed
+     * vblanks are counted from the gap to the previous present instead of the
+     * commit latency. Only frames which started rendering within one refresh
+     * of the previous present count, so idle gaps are not reported as misses.
+     *
+     * @param now_us The time the frame was presented.
+     * @param latency_us The time from commit to present, or 0 if the commit is unknown.
+     * @param refresh_us The refresh interval of the output at the time.
+     * @param seq The vblank counter at present time, or 0 if the backend does not report it.
+     * @param frame_start_us The time the frame started rendering, or 0 if unknown.
+     */
+    void push_presented(uint64_t now_us, uint64_t latency_us, uint64_t refresh_us, uint32_t seq,
+        uint64_t frame_start_us)
+    {
+        uint64_t interval = 0;
+        if (last_present && (now_us - last_present < frame_window_t::IDLE_GAP_US))
+        {
+            interval = now_us - last_present;
+        }
+
+        uint64_t missed = 0;
+        bool back_to_back = interval && refresh_us && frame_start_us &&
+            (frame_start_us < last_present + refresh_us);
+        if (back_to_back)
+        {
+            if (seq && last_seq && (uint32_t)(seq - last_seq) > 0)
+            {
+                missed = (uint32_t)(seq - last_seq) - 1;
+            } else
+            {
+                missed = std::max<uint64_t>(1, (interval + refresh_us / 2) / refresh_us) - 1;
+            }
+        }
+
+        push({0, now_us, latency_us, interval, missed, true});
+        last_present = now_us;
+        last_seq     = seq;
+    }
+
+    /** Record a commit which was never presented. */
+    void push_discarded(uint64_t now_us)
+    {
+        push({0, now_us, 0, 0, 0, false});
+    }
+
+    void expire(uint64_t oldest_allowed)
+    {
+        while (!events.empty() && (events.front().time < oldest_allowed))
+        {
+            drop_oldest();
+        }
+    }
+
+    present_summary_t summarize() const
+    {
+        present_summary_t s;
+        s.presented = presented;
+        s.discarded = events.size() - presented;
+        s.missed_vblanks = missed_sum;
+        s.refresh = intervals ? interval_sum / 1000.0 / intervals : 0;
+        s.latency_p50 = latency.quantile(0.50) / 1000.0;
+        s.latency_p99 = latency.quantile(0.99) / 1000.0;
+        s.latency_max = max_latency.get() / 1000.0;
+        return s;
+    }
+
+  private:
+    struct event_t
+    {
+        uint64_t seq;
+        uint64_t time;
+        uint64_t latency;
+        uint64_t interval;
+        uint64_t missed;
+        bool presented;
+    };
+
+    void push(event_t ev)
+    {
+        if (events.full())
+        {
+            drop_oldest();
+        }
+
+        ev.seq = next_seq++;
+        events.push_back(ev);
+        account(ev, 1);
+    }
+
+    void drop_oldest()
+    {
+        account(events.front(), -1);
+        events.pop_front();
+    }
+
+    void account(const event_t& ev, int sign)
+    {
+        presented += sign * ev.presented;
+        missed_sum += sign * ev.missed;
+        if (ev.latency)
+        {
+            sign > 0 ? latency.add(ev.latency) : latency.remove(ev.latency);
+            sign > 0 ? max_latency.push(ev.seq, ev.latency) : max_latency.remove(ev.seq);
+        }
+
+        if (ev.interval)
+        {
+            interval_sum += sign * ev.interval;
+            intervals    += sign;
+        }
+    }
+
+    ring_buffer_t<event_t> events;
+    frame_histogram_t latency;
+    sliding_extreme_t<std::greater<uint64_t>> max_latency;
+    uint64_t next_seq     = 0;
+    uint64_t last_present = 0;
+    uint32_t last_seq     = 0;
+    uint64_t presented    = 0;
+    uint64_t missed_sum   = 0;
+    uint64_t interval_sum = 0;
+    uint64_t intervals    = 0;
+};
+
+/**
+ * Searches for the highest load which still renders within the frame budget.
+ *
+ * The load is doubled as long as each step passes. After the first failing
+ * step, the search bisects between the highest passing and the lowest failing
+ * load until they are within 5% of each other.
+ */
+class load_ramp_t
+{
+  public:
+    static constexpr int MAX_LOAD = 1 << 16;
+
+    load_ramp_t(int start = 1) : load(std::clamp(start, 1, MAX_LOAD))
+    {}
+
+    /** The load to test in the current step. */
+    int current() const
+    {
+        return load;
+    }
+
+    bool done() const
+    {
+        return finished;
+    }
+
+    /** The highest load which passed so far. */
+    int max_sustained() const
+    {
+        return passed;
+    }
+
+    /** Record whether the current load could be sustained and pick the next one. */
+    void step_result(bool ok)
+    {
+        (ok ? passed : failed) = load;
+        if (failed < 0)
+        {
+            finished = (load == MAX_LOAD);
+            load     = std::min(load * 2, MAX_LOAD);
+            return;
+        }
+
+        if (failed - passed <= std::max(1, passed / 20))
+        {
+            finished = true;
+            return;
+        }
+
+        load = (passed + failed) / 2;
+    }
+
+  private:
+    int load;
+    int passed = 0;
+    int failed = -1;
+    bool finished = false;
+};
+}
+}
@@ -24,121 +24,1781 @@
  */
 
 #include <math.h>
-#include <deque>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
 #include <wayfire/config/types.hpp>
 #include <wayfire/geometry.hpp>
 #include <wayfire/plugin.hpp>
 #include <wayfire/output.hpp>
 #include <wayfire/util.hpp>
 #include <wayfire/render-manager.hpp>
+#include <wayfire/region.hpp>
+#include <wayfire/scene-operations.hpp>
+#include <wayfire/scene-render.hpp>
 #include <wayfire/per-output-plugin.hpp>
 #include <wayfire/plugins/common/cairo-util.hpp>
+#include <wayfire/plugins/common/shared-core-data.hpp>
+#include <wayfire/plugins/ipc/ipc-method-repository.hpp>
+#include <wayfire/plugins/ipc/ipc-helpers.hpp>
+#include <wayfire/nonstd/wlroots-full.hpp>
+#include <drm_fourcc.h>
+extern "C"
+{
+#include <wlr/interfaces/wlr_buffer.h>
+}
+#include "bench-stats.hpp"
+#include "binary-stream.hpp"
+#include "output-file.hpp"
+#include "trace.hpp"
+
+#if WAYFIRE_API_ABI_VERSION_MACRO >= 2025'05'19
+/**
+ * A wlr_buffer which gives the renderer access to the pixels of a cairo image
+ * surface, so that a texture can be updated from parts of the surface in
+ * place instead of being recreated.
+ */
+struct cairo_buffer_t
+{
+    wlr_buffer base;
+    cairo_surface_t *surface;
+
+    /** Wrap @surface, which must stay alive until the buffer is dropped. */
+    static cairo_buffer_t *create(cairo_surface_t *surface)
+    {
+        auto buffer = new cairo_buffer_t{};
+        buffer->surface = surface;
+        wlr_buffer_init(&buffer->base, get_impl(), cairo_image_surface_get_width(surface),
+            cairo_image_surface_get_height(surface));
+        return buffer;
+    }
+
+    /** Upload the @damage region of the surface to @tex, creating @tex if needed. */
+    void upload(std::unique_ptr<wf::owned_texture_t>& tex, const wf::region_t& damage)
+    {
+        // Not every renderer can update textures in place, the pixman one for example
+        if (!tex || !wlr_texture_update_from_buffer(tex->get_texture(), &base, damage.to_pixman()))
+        {
+            tex = std::make_unique<wf::owned_texture_t>(surface);
+        }
+    }
+
+    /** Free the buffer once the renderer no longer uses it. */
+    static void drop(cairo_buffer_t*& buffer)
+    {
+        if (buffer)
+        {
+            wlr_buffer_drop(&buffer->base);
+            buffer = nullptr;
+        }
+    }
+
+  private:
+    static const wlr_buffer_impl *get_impl()
+    {
+        static wlr_buffer_impl impl = [] ()
+        {
+            wlr_buffer_impl impl{};
+            impl.destroy = [] (wlr_buffer *buffer)
+            {
+                delete (cairo_buffer_t*)buffer;
+            };
+            impl.begin_data_ptr_access = [] (wlr_buffer *buffer, uint32_t flags, void **data,
+                                             uint32_t *format, size_t *stride)
+            {
+                auto surface = ((cairo_buffer_t*)buffer)->surface;
+                *data   = cairo_image_surface_get_data(surface);
+                *format = DRM_FORMAT_ARGB8888;
+                *stride = cairo_image_surface_get_stride(surface);
+                return !(flags & WLR_BUFFER_DATA_PTR_ACCESS_WRITE);
+            };
+            impl.end_data_ptr_access = [] (wlr_buffer*) {};
+            return impl;
+        }();
+
+        return &impl;
+    }
+};
+
+#endif
+
+/**
+ * Text drawn from a glyph atlas. The printable ASCII glyphs are rasterized
+ * once per output scale into one cairo surface, together with their advance
+ * widths. Changing the text only copies the glyphs into the text surface,
+ * which is then uploaded and drawn as a single texture. With the render API,
+ * the texture persists and only the part of it covered by the old and the new
+ * text is updated.
+ */
+class glyph_text_t
+{
+    static constexpr int FIRST_GLYPH = 32;
+    static constexpr int LAST_GLYPH  = 126;
+    static constexpr int GLYPH_COUNT = LAST_GLYPH - FIRST_GLYPH + 1;
+    static constexpr int ATLAS_COLUMNS = 16;
+    static constexpr int PADDING = 10;
+
+    struct glyph_t
+    {
+        // The ink box of the glyph in the atlas, in pixels
+        wf::geometry_t box;
+        // Offset of the ink box from the pen position on the baseline, in pixels
+        wf::point_t bearing;
+        // How far the pen moves after the glyph, in pixels
+        double x_advance;
+    };
+
+    std::array<glyph_t, GLYPH_COUNT> glyphs;
+    cairo_surface_t *atlas = nullptr;
+    double ascent = 0, line_height = 0;
+    int font_size;
+    float scale = 0;
+
+    // The laid out text, uploaded on the next get_texture() if dirty
+    cairo_surface_t *surface = nullptr;
+    std::string current_text;
+    bool dirty = false;
+    // The size of the text on the surface, in pixels
+    wf::dimensions_t pixels = {0, 0};
+#if WAYFIRE_API_ABI_VERSION_MACRO < 2025'05'19
+    wf::simple_texture_t tex;
+#else
+    // The size of the surface is rounded up to a multiple of this, leaving room for the text to grow
+    static constexpr int SURFACE_SLACK = 64;
+
+    std::unique_ptr<wf::owned_texture_t> tex;
+    cairo_buffer_t *buffer = nullptr;
+    // The part of the surface which changed since the last upload, in pixels
+    wf::region_t upload_damage;
+#endif
+
+    static void select_font(cairo_t *cr, double size)
+    {
+        cairo_select_font_face(cr, "sans-serif", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+        cairo_set_font_size(cr, size);
+    }
+
+    /** Rasterize all glyphs at the current scale into the atlas. */
+    void build_atlas()
+    {
+        // Measure the glyphs first to find the size of the atlas cells
+        auto measure = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+        auto cr = cairo_create(measure);
+        select_font(cr, font_size * scale);
+
+        cairo_font_extents_t font;
+        cairo_font_extents(cr, &font);
+        ascent = font.ascent;
+        line_height = font.height;
+
+        std::array<cairo_text_extents_t, GLYPH_COUNT> extents;
+        int cell_width = 1, cell_height = 1;
+        for (int i = 0; i < GLYPH_COUNT; i++)
+        {
+            char str[2] = {(char)(FIRST_GLYPH + i), 0};
+            cairo_text_extents(cr, str, &extents[i]);
+
+            // Keep the pen position on whole pixels, the ink box covers the rest
+            auto& g = glyphs[i];
+            g.bearing   = {(int)std::floor(extents[i].x_bearing) - 1, (int)std::floor(extents[i].y_bearing) - 1};
+            g.box.width = (int)std::ceil(extents[i].x_bearing + extents[i].width) - g.bearing.x + 1;
+            g.box.height = (int)std::ceil(extents[i].y_bearing + extents[i].height) - g.bearing.y + 1;
+            g.x_advance  = extents[i].x_advance;
+            cell_width   = std::max(cell_width, g.box.width);
+            cell_height  = std::max(cell_height, g.box.height);
+        }
+
+        cairo_destroy(cr);
+        cairo_surface_destroy(measure);
+
+        int rows = (GLYPH_COUNT + ATLAS_COLUMNS - 1) / ATLAS_COLUMNS;
+        if (atlas)
+        {
+            cairo_surface_destroy(atlas);
+        }
+
+        atlas = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, ATLAS_COLUMNS * cell_width, rows * cell_height);
+        cr = cairo_create(atlas);
+        select_font(cr, font_size * scale);
+        cairo_set_source_rgba(cr, 0.8, 0.8, 0.8, 0.8);
+        for (int i = 0; i < GLYPH_COUNT; i++)
+        {
+            auto& g = glyphs[i];
+            g.box.x = (i % ATLAS_COLUMNS) * cell_width;
+            g.box.y = (i / ATLAS_COLUMNS) * cell_height;
+
+            char str[2] = {(char)(FIRST_GLYPH + i), 0};
+            cairo_move_to(cr, g.box.x - g.bearing.x, g.box.y - g.bearing.y);
+            cairo_show_text(cr, str);
+        }
+
+        cairo_destroy(cr);
+        cairo_surface_flush(atlas);
+    }
+
+    void release()
+    {
+#if WAYFIRE_API_ABI_VERSION_MACRO < 2025'05'19
+        tex.release();
+#else
+        tex.reset();
+        cairo_buffer_t::drop(buffer);
+#endif
+        for (auto s : {&atlas, &surface})
+        {
+            if (*s)
+            {
+                cairo_surface_destroy(*s);
+                *s = nullptr;
+            }
+        }
+    }
+
+  public:
+    // The logical size of the text
+    wf::dimensions_t size = {0, 0};
+
+    glyph_text_t(int font_size) : font_size(font_size)
+    {}
+
+    ~glyph_text_t()
+    {
+        release();
+    }
+
+    bool empty() const
+    {
+        return !surface;
+    }
+
+    /** Lay out the text, rasterizing the glyphs again only if the scale changed. */
+    void set_text(const std::string& text, float scale)
+    {
+        if (scale != this->scale)
+        {
+            this->scale = scale;
+            build_atlas();
+        } else if (text == current_text)
+        {
+            return;
+        }
+
+        current_text = text;
+
+        // Measure the lines to size the text surface
+        double pad = PADDING * scale;
+        double x = 0, width = 0;
+        int lines = 1;
+        for (char c : text)
+        {
+            if (c == '\n')
+            {
+                x = 0;
+                ++lines;
+                continue;
+            }
+
+            int ch = ((c >= FIRST_GLYPH) && (c <= LAST_GLYPH)) ? c : '?';
+            x    += glyphs[ch - FIRST_GLYPH].x_advance;
+            width = std::max(width, x);
+        }
+
+        wf::dimensions_t old_pixels = pixels;
+        pixels = {(int)std::ceil(width + 2 * pad), (int)std::ceil(lines * line_height + 2 * pad)};
+        int surface_width  = surface ? cairo_image_surface_get_width(surface) : 0;
+        int surface_height = surface ? cairo_image_surface_get_height(surface) : 0;
+#if WAYFIRE_API_ABI_VERSION_MACRO < 2025'05'19
+        // The whole surface is uploaded and drawn, so it has the size of the text
+        if ((surface_width != pixels.width) || (surface_height != pixels.height))
+        {
+            if (surface)
+            {
+                cairo_surface_destroy(surface);
+            }
+
+            surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, pixels.width, pixels.height);
+        }
+
+#else
+        // Only the text is drawn from the texture, so the surface and the
+        // texture are reallocated only when the text outgrows them
+        if ((surface_width < pixels.width) || (surface_height < pixels.height))
+        {
+            auto round_up = [] (int v) { return (v + SURFACE_SLACK - 1) / SURFACE_SLACK * SURFACE_SLACK; };
+            tex.reset();
+            cairo_buffer_t::drop(buffer);
+            if (surface)
+            {
+                cairo_surface_destroy(surface);
+            }
+
+            surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, round_up(pixels.width),
+                round_up(pixels.height));
+            buffer  = cairo_buffer_t::create(surface);
+            old_pixels = {cairo_image_surface_get_width(surface), cairo_image_surface_get_height(surface)};
+        }
+
+        upload_damage |= wf::geometry_t{0, 0, std::max(old_pixels.width, pixels.width),
+            std::max(old_pixels.height, pixels.height)};
+#endif
+
+        // Copy the glyphs from the atlas, all in one cairo context
+        auto cr = cairo_create(surface);
+        cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+        cairo_rectangle(cr, 0, 0, std::max(old_pixels.width, pixels.width),
+            std::max(old_pixels.height, pixels.height));
+        cairo_fill(cr);
+        cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+
+        double pen_x = pad, baseline = pad + ascent;
+        for (char c : text)
+        {
+            if (c == '\n')
+            {
+                pen_x     = pad;
+                baseline += line_height;
+                continue;
+            }
+
+            int ch = ((c >= FIRST_GLYPH) && (c <= LAST_GLYPH)) ? c : '?';
+            auto& g = glyphs[ch - FIRST_GLYPH];
+            if (ch != ' ')
+            {
+                int dx = std::round(pen_x) + g.bearing.x;
+                int dy = std::round(baseline) + g.bearing.y;
+                cairo_set_source_surface(cr, atlas, dx - g.box.x, dy - g.box.y);
+                cairo_rectangle(cr, dx, dy, g.box.width, g.box.height);
+                cairo_fill(cr);
+            }
+
+            pen_x += g.x_advance;
+        }
+
+        cairo_destroy(cr);
+        cairo_surface_flush(surface);
+
+        size  = {int(std::ceil(pixels.width / scale)), int(std::ceil(pixels.height / scale))};
+        dirty = true;
+    }
+
+#if WAYFIRE_API_ABI_VERSION_MACRO < 2025'05'19
+    /** Upload the text if it changed, needs the GL context. */
+    GLuint get_texture()
+    {
+        if (dirty)
+        {
+            cairo_surface_upload_to_texture(surface, tex);
+            dirty = false;
+        }
+
+        return tex.tex;
+    }
+
+#else
+    /** Get the text from the texture, updating the parts of it which changed. */
+    wf::texture_t get_texture()
+    {
+        if (dirty || !tex)
+        {
+            buffer->upload(tex, upload_damage);
+            upload_damage.clear();
+            dirty = false;
+        }
+
+        wf::texture_t result{tex->get_texture()};
+        result.source_box = wlr_fbox{0, 0, (double)pixels.width, (double)pixels.height};
+        return result;
+    }
+
+#endif
+};
+
+/**
+ * A graph of frame intervals, one column per frame. The graph is a sweep: each
+ * frame overwrites the column at the cursor and advances it, wrapping around
+ * at the end, so only that column has to be written and uploaded into the
+ * persistent texture, and the whole graph is drawn as a single texture.
+ */
+class frame_graph_t
+{
+  public:
+    static constexpr int COLUMN_WIDTH = 2;
+    static constexpr int HEIGHT = 90;
+
+    ~frame_graph_t()
+    {
+        release();
+    }
+
+    /** Clear the graph and make room for @columns frames. */
+    void resize(int columns)
+    {
+        release();
+        columns = std::max(columns, 1);
+        surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, columns * COLUMN_WIDTH, HEIGHT);
+#if WAYFIRE_API_ABI_VERSION_MACRO >= 2025'05'19
+        buffer = cairo_buffer_t::create(surface);
+#endif
+        for (int i = 0; i < columns; i++)
+        {
+            write_column(i, 0, 1);
+        }
+
+        this->columns = columns;
+        cursor  = 0;
+        pending = columns;
+    }
+
+    int get_width() const
+    {
+        return columns * COLUMN_WIDTH;
+    }
+
+    /** The x coordinate of the column which will be written next. */
+    int get_cursor_x() const
+    {
+        return cursor * COLUMN_WIDTH;
+    }
+
+    void push(uint64_t interval_us, uint64_t budget_us)
+    {
+        write_column(cursor, interval_us, budget_us);
+        cursor  = (cursor + 1) % columns;
+        pending = std::min(pending + 1, columns);
+    }
+
+#if WAYFIRE_API_ABI_VERSION_MACRO < 2025'05'19
+    /** Upload the columns written since the last call, needs the GL context. */
+    GLuint get_texture()
+    {
+        int stride = cairo_image_surface_get_stride(surface);
+        auto data  = cairo_image_surface_get_data(surface);
+        if (!tex)
+        {
+            GL_CALL(glGenTextures(1, &tex));
+            GL_CALL(glBindTexture(GL_TEXTURE_2D, tex));
+            GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+            GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+            // cairo stores ARGB32 as BGRA bytes
+            GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_R, GL_BLUE));
+            GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_RED));
+            GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, get_width(), HEIGHT, 0, GL_RGBA,
+                GL_UNSIGNED_BYTE, nullptr));
+            pending = columns;
+        }
+
+        GL_CALL(glBindTexture(GL_TEXTURE_2D, tex));
+        GL_CALL(glPixelStorei(GL_UNPACK_ROW_LENGTH, stride / 4));
+        for (int i = 0; i < pending; i++)
+        {
+            int x = ((cursor - pending + i + columns) % columns) * COLUMN_WIDTH;
+            GL_CALL(glTexSubImage2D(GL_TEXTURE_2D, 0, x, 0, COLUMN_WIDTH, HEIGHT, GL_RGBA,
+                GL_UNSIGNED_BYTE, data + x * 4));
+        }
+
+        GL_CALL(glPixelStorei(GL_UNPACK_ROW_LENGTH, 0));
+        pending = 0;
+        return tex;
+    }
+
+#else
+    /** Upload the columns written since the last call. */
+    wlr_texture *get_texture()
+    {
+        if (!tex)
+        {
+            tex     = std::make_unique<wf::owned_texture_t>(surface);
+            pending = 0;
+        }
+
+        if (pending)
+        {
+            wf::region_t damage;
+            for (int i = 0; i < pending; i++)
+            {
+                int x = ((cursor - pending + i + columns) % columns) * COLUMN_WIDTH;
+                damage |= wf::geometry_t{x, 0, COLUMN_WIDTH, HEIGHT};
+            }
+
+            buffer->upload(tex, damage);
+            pending = 0;
+        }
+
+        return tex->get_texture();
+    }
+
+#endif
+
+  private:
+    static uint32_t to_argb32(wf::color_t c)
+    {
+        auto channel = [] (double v) { return (uint32_t)std::clamp(v * 255.0, 0.0, 255.0); };
+        return (channel(c.a) << 24) | (channel(c.r * c.a) << 16) | (channel(c.g * c.a) << 8) |
+               channel(c.b * c.a);
+    }
+
+    /** Draw the bar of one frame, with lines at one and two refresh intervals. */
+    void write_column(int column, uint64_t interval_us, uint64_t budget_us)
+    {
+        static const uint32_t background = to_argb32({0, 0, 0, 0.5});
+        static const uint32_t line  = to_argb32({0.8, 0.8, 0.8, 0.8});
+        static const uint32_t green = to_argb32({0, 0.6, 0, 0.6});
+        static const uint32_t yellow = to_argb32({0.6, 0.6, 0, 0.6});
+        static const uint32_t red = to_argb32({0.7, 0, 0, 0.7});
+
+        // The graph shows up to three refresh intervals, frames count as late
+        // above 1.5 intervals like in the statistics
+        double budget = std::max<uint64_t>(1, budget_us);
+        int height    = std::min(1.0, interval_us / (3 * budget)) * HEIGHT;
+        uint32_t bar  = (interval_us * 2 <= budget * 3) ? green : ((interval_us <= budget * 2.5) ? yellow : red);
+        int line1     = HEIGHT - HEIGHT / 3;
+        int line2     = HEIGHT - 2 * HEIGHT / 3;
+
+        cairo_surface_flush(surface);
+        int stride = cairo_image_surface_get_stride(surface);
+        auto data  = cairo_image_surface_get_data(surface);
+        for (int y = 0; y < HEIGHT; y++)
+        {
+            uint32_t color = (y == line1 || y == line2) ? line : ((y >= HEIGHT - height) ? bar : background);
+            auto row = (uint32_t*)(data + y * stride) + column * COLUMN_WIDTH;
+            std::fill(row, row + COLUMN_WIDTH, color);
+        }
+
+        cairo_surface_mark_dirty_rectangle(surface, column * COLUMN_WIDTH, 0, COLUMN_WIDTH, HEIGHT);
+    }
+
+    void release()
+    {
+#if WAYFIRE_API_ABI_VERSION_MACRO < 2025'05'19
+        if (tex)
+        {
+            OpenGL::render_begin();
+            GL_CALL(glDeleteTextures(1, &tex));
+            OpenGL::render_end();
+            tex = 0;
+        }
+
+#else
+        tex.reset();
+        cairo_buffer_t::drop(buffer);
+#endif
+        if (surface)
+        {
+            cairo_surface_destroy(surface);
+            surface = nullptr;
+        }
+    }
+
+    cairo_surface_t *surface = nullptr;
+#if WAYFIRE_API_ABI_VERSION_MACRO < 2025'05'19
+    GLuint tex = 0;
+#else
+    std::unique_ptr<wf::owned_texture_t> tex;
+    cairo_buffer_t *buffer = nullptr;
+#endif
+    int columns = 0;
+    int cursor  = 0;
+    // Columns written since the last upload
+    int pending = 0;
+};
+
+/**
+ * Synthetic load for stress tests: a number of solid quads moving in circles
+ * over the output, in output-local coordinates.
+ */
+class stress_node_t : public wf::scene::node_t
+{
+    class stress_render_instance_t : public wf::scene::simple_render_instance_t<stress_node_t>
+    {
+      public:
+        using simple_render_instance_t::simple_render_instance_t;
+
+#if WAYFIRE_API_ABI_VERSION_MACRO >= 2025'05'19
+        void render(const wf::scene::render_instruction_t& data) override
+        {
+            for (size_t i = 0; i < self->quads.size(); i++)
+            {
+                data.pass->add_rect(self->get_color(i), data.target, self->quads[i], data.damage);
+            }
+        }
+
+#else
+        void render(const wf::render_target_t& target, const wf::region_t& region) override
+        {
+            OpenGL::render_begin(target);
+            for (auto box : region)
+            {
+                target.logic_scissor(wlr_box_from_pixman_box(box));
+                for (size_t i = 0; i < self->quads.size(); i++)
+                {
+                    OpenGL::render_rectangle(self->quads[i], self->get_color(i),
+                        target.get_orthographic_projection());
+                }
+            }
+
+            OpenGL::render_end();
+        }
+#endif
+    };
+
+    std::vector<wf::geometry_t> quads;
+    wf::dimensions_t area;
+
+    wf::color_t get_color(size_t i)
+    {
+        return {(i % 3) * 0.4, ((i / 3) % 3) * 0.4, 0.8, 0.5};
+    }
+
+  public:
+    enum damage_pattern_t
+    {
+        // Each quad damages its old and new position
+        DAMAGE_MOVING,
+        // The whole output is damaged every frame
+        DAMAGE_FULL,
+    };
+
+    damage_pattern_t pattern = DAMAGE_MOVING;
+    int quad_size = 64;
+
+    stress_node_t(wf::dimensions_t area) : node_t(false), area(area)
+    {}
+
+    void gen_render_instances(std::vector<wf::scene::render_instance_uptr>& instances,
+        wf::scene::damage_callback push_damage, wf::output_t *output) override
+    {
+        instances.push_back(std::make_unique<stress_render_instance_t>(this, push_damage, output));
+    }
+
+    wf::geometry_t get_bounding_box() override
+    {
+        return {0, 0, area.width, area.height};
+    }
+
+    void set_count(int count)
+    {
+        wf::scene::damage_node(shared_from_this(), get_bounding_box());
+        quads.assign(count, {0, 0, quad_size, quad_size});
+    }
+
+    /** Move the quads to their positions at @time_ms and damage them. */
+    void step(uint32_t time_ms)
+    {
+        wf::region_t damage;
+        int radius = quad_size;
+        for (size_t i = 0; i < quads.size(); i++)
+        {
+            damage |= quads[i];
+
+            // Spread the centers over the output with a fixed pseudo-random sequence
+            uint32_t hash = i * 2654435761u;
+            int cx = radius + (hash % 7919) * std::max(1, area.width - 2 * radius - quad_size) / 7919;
+            int cy = radius + (hash / 7919 % 7919) * std::max(1, area.height - 2 * radius - quad_size) / 7919;
+            double angle = time_ms / 500.0 + i;
+            quads[i].x = cx + radius * std::cos(angle);
+            quads[i].y = cy + radius * std::sin(angle);
+            damage |= quads[i];
+        }
+
+        if (pattern == DAMAGE_FULL)
+        {
+            damage |= get_bounding_box();
+        }
+
+        wf::scene::damage_node(shared_from_this(), damage);
+    }
+};
 
 class wayfire_bench_screen : public wf::per_output_plugin_instance_t
 {
-    wf::cairo_text_t text;
+    glyph_text_t text{32};
 
     uint64_t last_refresh_time = 0;
-    std::deque<uint64_t> last_frame_times;
+    uint64_t last_stdout_time  = 0;
+    wf::bench::frame_window_t frames;
     wf::option_wrapper_t<double> average_frames{"ammen99-bench/average_frames"};
     wf::option_wrapper_t<double> refresh_interval{"ammen99-bench/refresh_interval"};
     wf::option_wrapper_t<bool> immediate_draw{"ammen99-bench/immediate_draw"};
     wf::option_wrapper_t<bool> use_stdout{"ammen99-bench/stdout"};
+    wf::option_wrapper_t<bool> show_overlay{"ammen99-bench/show_overlay"};
+    wf::option_wrapper_t<bool> show_graph{"ammen99-bench/graph"};
+    wf::option_wrapper_t<int> graph_frames{"ammen99-bench/graph_frames"};
+    wf::option_wrapper_t<bool> presentation_feedback{"ammen99-bench/presentation_feedback"};
+
+    frame_graph_t graph;
+
+    /** A running stress test, see start_stress(). */
+    struct stress_test_t
+    {
+        std::shared_ptr<stress_node_t> node;
+        wf::bench::load_ramp_t ramp;
+        bool ramping = false;
+        uint64_t step_duration = 0;
+        uint64_t step_start    = 0;
+        uint64_t step_frames   = 0;
+        uint64_t step_late     = 0;
+    };
+
+    // Frames right after the load changes are not counted
+    static constexpr uint64_t STRESS_WARMUP_US = 250'000;
+
+    std::optional<stress_test_t> stress;
+    // The result of the last finished ramp, -1 if none has finished yet
+    int stress_max_sustained = -1;
+    wf::wl_idle_call idle_stop_stress;
 
     wf::wl_timer<true> timer;
 
+    /**
+     * Timestamps (in ns) of the boundaries between the phases of the current
+     * frame: frame event, pre hook, end of the damage hook, overlay hook,
+     * output precommit and output commit. Phase N lasts from phase_marks[N] to phase_marks[N + 1].
+     */
+    std::array<uint64_t, wf::bench::PHASE_COUNT + 1> phase_marks;
+    // The index of the next expected mark, -1 if the frame is not timed
+    int next_mark = -1;
+    bool frame_recorded = false;
+    // Whether there was damage left to draw when the last frame ended
+    bool redraw_pending = false;
+
+    wf::wl_listener_wrapper on_frame, on_precommit, on_commit;
+
+    /**
+     * The commits which have been started but not yet presented, indexed by
+     * their commit sequence number.
+     */
+    struct pending_commit_t
+    {
+        uint32_t seq = 0;
+        uint64_t time = 0;
+        // When the frame of the commit started, 0 for commits outside of a frame
+        uint64_t frame_start = 0;
+    };
+
+    wf::shared_data::ref_ptr_t<wf::trace::recorder_t> tracer;
+    uint16_t trace_frame, trace_damage, trace_render, trace_commit, trace_present;
+    uint32_t trace_track;
+    bool in_frame = false, in_render = false, in_commit = false;
+
+    std::array<pending_commit_t, 4> pending_commits;
+    wf::bench::present_window_t presents;
+    wf::wl_listener_wrapper on_present;
+
+    void handle_present(wlr_output_event_present *ev)
+    {
+        uint64_t now = wf::bench::get_current_time_us();
+        if (!ev->presented)
+        {
+            presents.push_discarded(now);
+        } else
+        {
+            uint64_t when = wf::bench::timespec_to_us(ev->when);
+            when = when ? when : now;
+
+            auto& commit = pending_commits[ev->commit_seq % pending_commits.size()];
+
+            uint64_t latency = 0, frame_start = 0;
+            if ((commit.seq == ev->commit_seq) && (when >= commit.time))
+            {
+                latency     = std::max<uint64_t>(1, when - commit.time);
+                frame_start = commit.frame_start;
+            }
+
+            uint64_t refresh = ev->refresh > 0 ? ev->refresh / 1000 : get_frame_budget();
+            presents.push_presented(when, latency, refresh, ev->seq, frame_start);
+            tracer->record(trace_present, wf::trace::PHASE_INSTANT, trace_track, latency);
+        }
+
+        presents.expire(now - 1'000'000ll * average_frames);
+    }
+
+    void end_commit_trace()
+    {
+        if (in_commit)
+        {
+            tracer->record(trace_commit, wf::trace::PHASE_END, trace_track);
+            in_commit = false;
+        }
+    }
+
+    /** Record the next phase boundary, if it is the one we expect. */
+    void mark_phase(int mark)
+    {
+        if (next_mark == mark)
+        {
+            phase_marks[mark] = wf::bench::get_current_time_ns();
+            ++next_mark;
+        }
+    }
+
   public:
     void init() override
     {
-        output->render->add_effect(&pre_hook, wf::OUTPUT_EFFECT_DAMAGE);
+        trace_frame   = tracer->intern("frame");
+        trace_damage  = tracer->intern("damage");
+        trace_render  = tracer->intern("render");
+        trace_commit  = tracer->intern("commit");
+        trace_present = tracer->intern("present");
+        trace_track   = output->get_id();
+
+        // The window is reallocated only when the option changes, never on the frame path
+        frames   = wf::bench::frame_window_t{average_frames};
+        presents = wf::bench::present_window_t{average_frames};
+        average_frames.set_callback([=] ()
+        {
+            frames   = wf::bench::frame_window_t{average_frames};
+            presents = wf::bench::present_window_t{average_frames};
+        });
+
+        graph.resize(graph_frames);
+        graph_frames.set_callback([=] ()
+        {
+            graph.resize(graph_frames);
+            damage_overlay();
+        });
+
+        // Wayfire runs the pre hooks before collecting damage and the damage hooks after it
+        output->render->add_effect(&pre_hook, wf::OUTPUT_EFFECT_PRE);
+        output->render->add_effect(&damage_hook, wf::OUTPUT_EFFECT_DAMAGE);
         output->render->add_effect(&overlay_hook, wf::OUTPUT_EFFECT_OVERLAY);
+        output->render->add_effect(&post_hook, wf::OUTPUT_EFFECT_POST);
+
+        on_frame.set_callback([=] (void*)
+        {
+            next_mark = 0;
+            mark_phase(0);
+        });
+        on_precommit.set_callback([=] (void*)
+        {
+            mark_phase(4);
+            if (in_frame && !in_commit)
+            {
+                tracer->record(trace_commit, wf::trace::PHASE_BEGIN, trace_track);
+                in_commit = true;
+            }
+
+            // The backend may send the present event before the commit event
+            uint32_t seq = output->handle->commit_seq + 1;
+            uint64_t frame_start = (next_mark > 0) ? phase_marks[0] / 1000 : 0;
+            pending_commits[seq % pending_commits.size()] = {seq, wf::bench::get_current_time_us(), frame_start};
+        });
+        on_commit.set_callback([=] (void*)
+        {
+            mark_phase(5);
+            end_commit_trace();
+        });
+        on_frame.connect(&output->handle->events.frame);
+        on_precommit.connect(&output->handle->events.precommit);
+        on_commit.connect(&output->handle->events.commit);
+
+        on_present.set_callback([=] (void *data)
+        {
+            handle_present((wlr_output_event_present*)data);
+        });
+        presentation_feedback.set_callback([=] () { update_present_listener(); });
+        update_present_listener();
 
         // Ensure we render at least 1 fps
         timer.set_timeout(1000, [=] ()
         {
-            output->render->damage(get_geometry());
+            if (show_overlay)
+            {
+                damage_overlay();
+            }
+
             return true;
         });
     }
 
-    wf::geometry_t get_geometry()
-    {
-        int x = output->get_screen_size().width / 2.0 - text.get_size().width / 2.0;
-        int y = 30;
-        return wf::construct_box({x, y}, text.get_size());
+    void update_present_listener()
+    {
+        on_present.disconnect();
+        presents = wf::bench::present_window_t{average_frames};
+        if (presentation_feedback)
+        {
+            on_present.connect(&output->handle->events.present);
+        }
+    }
+
+    /** Get the statistics for the last average_frames seconds. */
+    wf::bench::frame_summary_t get_summary()
+    {
+        frames.expire(wf::bench::get_current_time_us() - 1'000'000ll * average_frames);
+        return frames.summarize(average_frames);
+    }
+
+    wf::bench::present_summary_t get_present_summary()
+    {
+        presents.expire(wf::bench::get_current_time_us() - 1'000'000ll * average_frames);
+        return presents.summarize();
+    }
+
+    wf::json_t get_stats_json()
+    {
+        auto s = get_summary();
+
+        wf::json_t js;
+        js["output"]      = output->to_string();
+        js["output-id"]   = output->get_id();
+        js["window"]      = (double)average_frames;
+        js["fps"]         = s.fps;
+        js["frames"]      = s.frames;
+        js["min"]         = s.min;
+        js["p50"]         = s.p50;
+        js["p95"]         = s.p95;
+        js["p99"]         = s.p99;
+        js["max"]         = s.max;
+        js["mean"]        = s.mean;
+        js["budget"]      = s.budget;
+        js["over-budget"] = s.over_budget;
+        js["overhead"]    = s.overhead;
+        js["timed-frames"] = s.timed_frames;
+        js["idle-gaps"]    = s.idle_gaps;
+
+        wf::json_t phases;
+        for (int i = 0; i < wf::bench::PHASE_COUNT; i++)
+        {
+            phases[wf::bench::phase_names[i]] = s.phases[i];
+        }
+
+        js["phases"] = phases;
+
+        if (presentation_feedback)
+        {
+            auto p = get_present_summary();
+
+            wf::json_t present;
+            present["presented"]      = p.presented;
+            present["discarded"]      = p.discarded;
+            present["missed-vblanks"] = p.missed_vblanks;
+            present["latency-p50"]    = p.latency_p50;
+            present["latency-p99"]    = p.latency_p99;
+            present["latency-max"]    = p.latency_max;
+            present["refresh"]        = p.refresh;
+            js["presentation"] = present;
+        }
+        return js;
+    }
+
+    void damage_overlay()
+    {
+        output->render->damage(get_geometry());
+        if (show_graph)
+        {
+            output->render->damage(get_graph_geometry());
+        }
+    }
+
+    wf::geometry_t get_graph_geometry()
+    {
+        auto text_box = get_geometry();
+        int width = graph.get_width();
+        int x     = output->get_screen_size().width / 2.0 - width / 2.0;
+        return {x, text_box.y + text_box.height + 10, width, frame_graph_t::HEIGHT};
+    }
+
+    wf::geometry_t get_geometry()
+    {
+        int x = output->get_screen_size().width / 2.0 - text.size.width / 2.0;
+        int y = 30;
+        return wf::construct_box({x, y}, text.size);
+    }
+
+    /** The refresh interval of the output in microseconds. */
+    uint64_t get_frame_budget()
+    {
+        // Fall back to 60Hz for outputs which do not report a refresh rate
+        int refresh_mhz = output->handle->refresh > 0 ? output->handle->refresh : 60'000;
+        return 1'000'000'000ull / refresh_mhz;
+    }
+
+    /**
+     * Add @count moving quads to the output. If @ramp is set, the number of
+     * quads is adjusted every @step_seconds to find the highest load at which
+     * at most 2% of the frames are late.
+     */
+    void start_stress(int count, stress_node_t::damage_pattern_t pattern, int quad_size,
+        bool ramp, double step_seconds)
+    {
+        stop_stress();
+        stress = stress_test_t{};
+        stress->node = std::make_shared<stress_node_t>(output->get_screen_size());
+        stress->node->pattern   = pattern;
+        stress->node->quad_size = quad_size;
+        stress->ramp    = wf::bench::load_ramp_t{count};
+        stress->ramping = ramp;
+        stress->step_duration = step_seconds * 1'000'000;
+        wf::scene::add_front(output->node_for_layer(wf::scene::layer::TOP), stress->node);
+        start_stress_step();
+    }
+
+    void stop_stress()
+    {
+        idle_stop_stress.disconnect();
+        if (stress)
+        {
+            wf::scene::remove_child(stress->node);
+            stress.reset();
+        }
+    }
+
+    wf::json_t get_stress_json()
+    {
+        wf::json_t js;
+        js["output"]  = output->to_string();
+        js["running"] = stress.has_value();
+        if (stress)
+        {
+            js["load"]    = stress->ramp.current();
+            js["ramping"] = stress->ramping && !stress->ramp.done();
+            js["pattern"] = (stress->node->pattern == stress_node_t::DAMAGE_FULL) ? "full" : "moving";
+        }
+
+        js["max-sustained"] = stress_max_sustained;
+        return js;
+    }
+
+    void start_stress_step()
+    {
+        stress->node->set_count(stress->ramp.current());
+        stress->step_start  = wf::bench::get_current_time_us();
+        stress->step_frames = 0;
+        stress->step_late   = 0;
+        output->render->schedule_redraw();
+    }
+
+    /** Count a frame of the stress test and move to the next load when the step is over. */
+    void update_stress(uint64_t now, uint64_t interval)
+    {
+        uint64_t elapsed = now - stress->step_start;
+        if ((elapsed < STRESS_WARMUP_US) || stress->ramp.done())
+        {
+            return;
+        }
+
+        if (interval)
+        {
+            stress->step_frames++;
+            stress->step_late += (interval * 2 > get_frame_budget() * 3);
+        }
+
+        if (!stress->ramping || (elapsed < STRESS_WARMUP_US + stress->step_duration))
+        {
+            return;
+        }
+
+        bool ok = (stress->step_frames > 0) && (stress->step_late * 50 <= stress->step_frames);
+        stress->ramp.step_result(ok);
+        if (!stress->ramp.done())
+        {
+            start_stress_step();
+            return;
+        }
+
+        stress_max_sustained = stress->ramp.max_sustained();
+        LOGI(output->to_string(), ": maximum sustainable stress load is ", stress_max_sustained, " quads");
+
+        // We are in the middle of a frame, remove the quads once it is done
+        idle_stop_stress.run_once([=] () { stop_stress(); });
     }
 
     void compute_timing()
     {
-        last_frame_times.push_back(wf::get_current_time());
+        uint64_t current_time = wf::bench::get_current_time_us();
+        frames.set_budget(get_frame_budget());
+        uint64_t interval = frames.push(current_time, redraw_pending);
+        if (stress)
+        {
+            update_stress(current_time, interval);
+        }
 
-        uint64_t current_time = wf::get_current_time();
-        uint64_t oldest_allowed = current_time - 1000ll * average_frames;
-        while (!last_frame_times.empty() && last_frame_times.front() < oldest_allowed)
+        if (show_graph)
         {
-            last_frame_times.pop_front();
+            graph.push(interval, get_frame_budget());
         }
 
-        if (current_time - last_refresh_time >= refresh_interval * 1000)
+        frames.expire(current_time - 1'000'000ll * average_frames);
+
+        if ((show_overlay || use_stdout) &&
+            (current_time - last_refresh_time >= refresh_interval * 1'000'000))
         {
-            render_bench(last_frame_times.size() / average_frames);
+            render_bench(frames.summarize(average_frames));
             last_refresh_time = current_time;
         }
     }
 
-    void render_bench(double current_fps)
+    void render_bench(const wf::bench::frame_summary_t& s)
     {
-        char fps_buf[128];
-        sprintf(fps_buf, "fps: %.1f", current_fps);
+        using namespace wf::bench;
+        char fps_buf[256];
+        snprintf(fps_buf, sizeof(fps_buf), "fps: %.1f  late: %lu\n"
+                                           "min %.1f  p50 %.1f  p95 %.1f  p99 %.1f  max %.1f ms\n"
+                                           "dmg %.2f  rnd %.2f  ovl %.2f  cmt %.2f ms",
+            s.fps, (unsigned long)s.over_budget, s.min, s.p50, s.p95, s.p99, s.max,
+            s.phases[PHASE_DAMAGE], s.phases[PHASE_RENDER], s.phases[PHASE_OVERLAY], s.phases[PHASE_COMMIT]);
+
+        present_summary_t p;
+        if (presentation_feedback)
+        {
+            p = get_present_summary();
+            size_t len = strlen(fps_buf);
+            snprintf(fps_buf + len, sizeof(fps_buf) - len, "\nlatency p50 %.1f  p99 %.1f ms  missed: %lu",
+                p.latency_p50, p.latency_p99, (unsigned long)p.missed_vblanks);
+        }
+
         if (use_stdout)
         {
-            static uint64_t last_update = 0;
-            auto current_time = wf::get_current_time();
-            if (current_time - last_update >= refresh_interval * 1000)
+            auto current_time = wf::bench::get_current_time_us();
+            if (current_time - last_stdout_time >= refresh_interval * 1'000'000)
             {
-                LOGI("Running at ", current_fps, " fps");
-                last_update = current_time;
+                LOGI(output->to_string(), ": ", s.fps, " fps, frame time (ms) min ", s.min, " p50 ", s.p50,
+                    " p95 ", s.p95, " p99 ", s.p99, " max ", s.max, ", ", s.over_budget, "/", s.frames,
+                    " frames over the ", s.budget, "ms budget, bench overhead ", s.overhead, "us/frame");
+                LOGI(output->to_string(), ": frame phases (ms) wait ", s.phases[PHASE_WAIT],
+                    " damage ", s.phases[PHASE_DAMAGE], " render ", s.phases[PHASE_RENDER],
+                    " overlay ", s.phases[PHASE_OVERLAY], " commit ", s.phases[PHASE_COMMIT]);
+                if (presentation_feedback)
+                {
+                    LOGI(output->to_string(), ": commit to present latency (ms) p50 ", p.latency_p50,
+                        " p99 ", p.latency_p99, " max ", p.latency_max, ", refresh interval ", p.refresh,
+                        "ms, ", p.missed_vblanks, " missed vblanks, ", p.discarded, " discarded frames");
+                }
+
+                last_stdout_time = current_time;
             }
         }
 
-        wf::cairo_text_t::params params;
-        params.font_size = 32;
-        params.bg_color = wf::color_t{0, 0, 0, 0.5};
-        params.text_color = wf::color_t{0.8, 0.8, 0.8, 0.8};
-        text.render_text(fps_buf, params);
+        text.set_text(fps_buf, output->handle->scale);
     }
 
     wf::effect_hook_t pre_hook = [=] ()
+    {
+        // The pre hook may run without a frame event, e.g. for the first frame
+        if (next_mark != 1)
+        {
+            next_mark = 0;
+            mark_phase(0);
+        }
+
+        mark_phase(1);
+        if (!in_frame)
+        {
+            tracer->record(trace_frame, wf::trace::PHASE_BEGIN, trace_track);
+            in_frame = true;
+        }
+
+        tracer->record(trace_damage, wf::trace::PHASE_INSTANT, trace_track);
+        frame_recorded = false;
+        if (stress)
+        {
+            // Damage the moved quads before Wayfire collects the damage of this frame
+            stress->node->step(wf::get_current_time());
+        }
+    };
+
+    wf::effect_hook_t damage_hook = [=] ()
     {
         if (!output->render->get_scheduled_damage().empty() || immediate_draw)
         {
-            output->render->damage(get_geometry());
+            frame_recorded = true;
+            uint64_t start = wf::bench::get_current_time_ns();
+            if (show_overlay)
+            {
+                damage_overlay();
+            }
+
             compute_timing();
+            if (show_overlay)
+            {
+                // The text may have grown
+                damage_overlay();
+            }
+
+            frames.add_overhead(wf::bench::get_current_time_ns() - start);
+        }
+
+        // Rendering starts once the damage has been collected
+        mark_phase(2);
+        if (in_frame && !in_render)
+        {
+            tracer->record(trace_render, wf::trace::PHASE_BEGIN, trace_track);
+            in_render = true;
         }
     };
 
     wf::effect_hook_t overlay_hook = [=] ()
     {
+        mark_phase(3);
+        if (in_render)
+        {
+            tracer->record(trace_render, wf::trace::PHASE_END, trace_track);
+            in_render = false;
+        }
+
+        if (show_overlay)
+        {
+            uint64_t start = wf::bench::get_current_time_ns();
+            draw_overlay();
+            frames.add_overhead(wf::bench::get_current_time_ns() - start);
+        }
+    };
+
+    wf::effect_hook_t post_hook = [=] ()
+    {
+        if ((next_mark == (int)phase_marks.size()) && frame_recorded)
+        {
+            wf::bench::frame_phases_t phases;
+            for (int i = 0; i < wf::bench::PHASE_COUNT; i++)
+            {
+                phases[i] = phase_marks[i + 1] - phase_marks[i];
+            }
+
+            frames.set_phases(phases);
+        }
+
+        next_mark = -1;
+        if (stress)
+        {
+            // Keep the quads moving
+            output->render->schedule_redraw();
+        }
+
+        // A long gap until the next frame is only idle time if nothing is left to draw
+        redraw_pending = stress || !output->render->get_scheduled_damage().empty();
+
+        if (in_frame)
+        {
+            // The frame may have been skipped or the commit may have failed,
+            // in which case the spans never ended
+            if (in_render)
+            {
+                tracer->record(trace_render, wf::trace::PHASE_END, trace_track);
+                in_render = false;
+            }
+
+            end_commit_trace();
+            tracer->record(trace_frame, wf::trace::PHASE_END, trace_track);
+            in_frame = false;
+        }
+    };
+
+    void draw_overlay()
+    {
+        const wf::color_t bg_color{0, 0, 0, 0.5};
         auto fb = output->render->get_target_framebuffer();
+        auto geometry = get_geometry();
+
 #if WAYFIRE_API_ABI_VERSION_MACRO < 2025'05'19
-            OpenGL::render_begin(fb);
-            OpenGL::render_transformed_texture(wf::texture_t{text.tex.tex},
-                get_geometry(), fb.get_orthographic_projection(), glm::vec4(1.0),
-                OpenGL::TEXTURE_TRANSFORM_INVERT_Y);
-            OpenGL::render_end();
+        OpenGL::render_begin(fb);
+        auto draw_rect = [&] (wf::geometry_t box, wf::color_t color)
+        {
+            OpenGL::render_rectangle(box, color, fb.get_orthographic_projection());
+        };
+        auto draw_text_texture = [&] (wf::geometry_t box)
+        {
+            OpenGL::render_transformed_texture(wf::texture_t{text.get_texture()}, box,
+                fb.get_orthographic_projection(), glm::vec4(1.0), OpenGL::TEXTURE_TRANSFORM_INVERT_Y);
+        };
+        auto draw_graph_texture = [&] (wf::geometry_t box)
+        {
+            OpenGL::render_transformed_texture(wf::texture_t{graph.get_texture()}, box,
+                fb.get_orthographic_projection(), glm::vec4(1.0), OpenGL::TEXTURE_TRANSFORM_INVERT_Y);
+        };
 #else
-            output->render->get_current_pass()->add_texture(
-                wf::texture_t{text.get_texture()}, fb, get_geometry(), fb.geometry);
+        auto pass = output->render->get_current_pass();
+        auto draw_rect = [&] (wf::geometry_t box, wf::color_t color)
+        {
+            pass->add_rect(color, fb, box, fb.geometry);
+        };
+        auto draw_text_texture = [&] (wf::geometry_t box)
+        {
+            pass->add_texture(text.get_texture(), fb, box, fb.geometry);
+        };
+        auto draw_graph_texture = [&] (wf::geometry_t box)
+        {
+            pass->add_texture(wf::texture_t{graph.get_texture()}, fb, box, fb.geometry);
+        };
 #endif
-    };
+
+        draw_rect(geometry, bg_color);
+        if (!text.empty())
+        {
+            draw_text_texture(geometry);
+        }
+
+        if (show_graph)
+        {
+            // The cursor marks where the newest frame was written
+            auto box = get_graph_geometry();
+            draw_graph_texture(box);
+            draw_rect({box.x + graph.get_cursor_x(), box.y, 1, box.height}, wf::color_t{1, 1, 1, 0.8});
+        }
+
+#if WAYFIRE_API_ABI_VERSION_MACRO < 2025'05'19
+        OpenGL::render_end();
+#endif
+    }
 
     void fini() override
     {
+        stop_stress();
         timer.disconnect();
+        on_frame.disconnect();
+        on_precommit.disconnect();
+        on_commit.disconnect();
+        on_present.disconnect();
         output->render->rem_effect(&pre_hook);
+        output->render->rem_effect(&damage_hook);
         output->render->rem_effect(&overlay_hook);
+        output->render->rem_effect(&post_hook);
         output->render->damage_whole();
     }
 };
 
-DECLARE_WAYFIRE_PLUGIN(wf::per_output_plugin_t<wayfire_bench_screen>);
+class wayfire_bench : public wf::per_output_plugin_t<wayfire_bench_screen>
+{
+    wf::shared_data::ref_ptr_t<wf::ipc::method_repository_t> repository;
+    wf::shared_data::ref_ptr_t<wf::binary_stream::streams_t> streams;
+    wf::option_wrapper_t<double> ipc_interval{"ammen99-bench/ipc_interval"};
+
+    std::set<wf::ipc::client_interface_t*> watchers;
+    wf::wl_timer<true> watch_timer;
+
+    wf::shared_data::ref_ptr_t<wf::trace::recorder_t> tracer;
+
+  public:
+    void init() override
+    {
+        per_output_plugin_t::init();
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/bench/stats", method_stats);
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/bench/watch", method_watch);
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/bench/save_baseline", method_save_baseline);
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/bench/compare", method_compare);
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/bench/stress", method_stress);
+        repository->connect(&on_client_disconnected);
+        ipc_interval.set_callback([=] ()
+        {
+            if (!watchers.empty())
+            {
+                arm_watch_timer();
+            }
+        });
+    }
+
+    void fini() override
+    {
+        repository->unregister_method("ammen99/bench/stats");
+        repository->unregister_method("ammen99/bench/watch");
+        repository->unregister_method("ammen99/bench/save_baseline");
+        repository->unregister_method("ammen99/bench/compare");
+        repository->unregister_method("ammen99/bench/stress");
+        watch_timer.disconnect();
+        per_output_plugin_t::fini();
+    }
+
+    wf::json_t get_all_stats()
+    {
+        wf::json_t outputs = wf::json_t::array();
+        for (auto& [wo, instance] : output_instance)
+        {
+            outputs.append(instance->get_stats_json());
+        }
+
+        return outputs;
+    }
+
+    wf::ipc::method_callback method_stats = [=] (const wf::json_t& data)
+    {
+        auto response = wf::ipc::json_ok();
+        if (data.has_member("output"))
+        {
+            auto name = wf::ipc::json_get_string(data, "output");
+            for (auto& [wo, instance] : output_instance)
+            {
+                if (wo->to_string() == name)
+                {
+                    response["outputs"] = wf::json_t::array();
+                    response["outputs"].append(instance->get_stats_json());
+                    return response;
+                }
+            }
+
+            return wf::ipc::json_error("no such output: " + name);
+        }
+
+        response["outputs"] = get_all_stats();
+        return response;
+    };
+
+    /**
+     * Subscribe the client to periodic updates of the statistics of all outputs,
+     * sent every ipc_interval seconds.
+     */
+    wf::ipc::method_callback_full method_watch = [=] (const wf::json_t&, wf::ipc::client_interface_t *client)
+    {
+        if (!client)
+        {
+            return wf::ipc::json_error("watch can only be used by IPC clients");
+        }
+
+        watchers.insert(client);
+        if (watchers.size() == 1)
+        {
+            arm_watch_timer();
+        }
+
+        return wf::ipc::json_ok();
+    };
+
+    /** (Re)start sending the statistics to the watchers every ipc_interval seconds. */
+    void arm_watch_timer()
+    {
+        watch_timer.disconnect();
+        watch_timer.set_timeout(std::max(1.0, ipc_interval * 1000), [=] ()
+        {
+            wf::json_t event;
+            event["event"]   = "ammen99/bench/stats";
+            event["outputs"] = get_all_stats();
+            streams->send_event(watchers, event);
+            return true;
+        });
+    }
+
+    /**
+     * Save the current statistics of all outputs to the file at the absolute
+     * @path, as a baseline for ammen99/bench/compare. Existing files are only
+     * overwritten if they are regular files.
+     */
+    wf::ipc::method_callback method_save_baseline = [=] (const wf::json_t& data)
+    {
+        auto path = wf::ipc::json_get_string(data, "path");
+
+        wf::json_t baseline;
+        baseline["name"]    = wf::ipc::json_get_optional_string(data, "name").value_or(path);
+        baseline["outputs"] = get_all_stats();
+
+        auto error = wf::write_output_file(path, baseline.serialize());
+        if (!error.empty())
+        {
+            return wf::ipc::json_error(error);
+        }
+
+        return wf::ipc::json_ok();
+    };
+
+    /**
+     * The metrics compared against a baseline, all of them lower-is-better.
+     * Frame times are in milliseconds, missed frames are a fraction of all
+     * frames.
+     */
+    static std::map<std::string, double> get_compared_metrics(const wf::json_t& stats)
+    {
+        auto get = [] (const wf::json_t& js, const std::string& key)
+        {
+            return wf::ipc::json_get_optional_double(js, key).value_or(0.0);
+        };
+
+        std::map<std::string, double> metrics;
+        for (auto key : {"p50", "p95", "p99", "mean"})
+        {
+            metrics[key] = get(stats, key);
+        }
+
+        double frames = get(stats, "frames");
+        metrics["missed-frames"] = (frames > 0) ? get(stats, "over-budget") / frames : 0.0;
+
+        if (stats.has_member("phases"))
+        {
+            for (int i = 0; i < wf::bench::PHASE_COUNT; i++)
+            {
+                std::string name = wf::bench::phase_names[i];
+                metrics["phase-" + name] = get(stats["phases"], name);
+            }
+        }
+
+        if (stats.has_member("presentation"))
+        {
+            double presented = get(stats["presentation"], "presented");
+            metrics["missed-vblanks"] = (presented > 0) ?
+                get(stats["presentation"], "missed-vblanks") / presented : 0.0;
+            metrics["latency-p99"] = get(stats["presentation"], "latency-p99");
+        }
+
+        return metrics;
+    }
+
+    static bool is_number(const wf::json_t& js)
+    {
+        return js.is_double() || js.is_int64() || js.is_uint64();
+    }
+
+    /**
+     * Check that the statistics of one output in a baseline file have the
+     * types which get_compared_metrics() expects, so that a hand-edited or
+     * stale baseline cannot make it throw.
+     *
+     * @return An error message, or an empty string if the output is valid.
+     */
+    static std::string validate_baseline_output(const wf::json_t& stats)
+    {
+        if (!stats.is_object() || !stats.has_member("output") || !stats["output"].is_string())
+        {
+            return "output without a name";
+        }
+
+        auto check_numbers = [] (const wf::json_t& js, std::vector<std::string> keys) -> std::string
+        {
+            for (auto& key : keys)
+            {
+                if (js.has_member(key) && !is_number(js[key]))
+                {
+                    return "\"" + key + "\" is not a number";
+                }
+            }
+
+            return "";
+        };
+
+        auto error = check_numbers(stats, {"p50", "p95", "p99", "mean", "frames", "over-budget"});
+        if (error.empty() && stats.has_member("phases"))
+        {
+            if (!stats["phases"].is_object())
+            {
+                return "\"phases\" is not an object";
+            }
+
+            error = check_numbers(stats["phases"], {std::begin(wf::bench::phase_names),
+                std::end(wf::bench::phase_names)});
+        }
+
+        if (error.empty() && stats.has_member("presentation"))
+        {
+            if (!stats["presentation"].is_object())
+            {
+                return "\"presentation\" is not an object";
+            }
+
+            error = check_numbers(stats["presentation"], {"presented", "missed-vblanks", "latency-p99"});
+        }
+
+        return error.empty() ? "" : stats["output"].as_string() + ": " + error;
+    }
+
+    /**
+     * Compare one output's statistics against its baseline. A metric passes if
+     * it is not worse than the baseline by more than @tolerance (relative),
+     * plus a small absolute slack so that near-zero values do not fail on noise.
+     */
+    static wf::json_t compare_output(const wf::json_t& baseline, const wf::json_t& current,
+        double tolerance)
+    {
+        static constexpr double TIME_SLACK_MS = 0.25;
+        static constexpr double FRACTION_SLACK = 0.01;
+
+        auto base_metrics = get_compared_metrics(baseline);
+        auto cur_metrics  = get_compared_metrics(current);
+
+        bool pass = true;
+        wf::json_t metrics;
+        for (auto& [name, base] : base_metrics)
+        {
+            if (!cur_metrics.count(name))
+            {
+                continue;
+            }
+
+            double cur   = cur_metrics[name];
+            bool is_fraction = (name == "missed-frames") || (name == "missed-vblanks");
+            double slack = is_fraction ? FRACTION_SLACK : TIME_SLACK_MS;
+            bool metric_pass = cur <= base * (1 + tolerance) + slack;
+            pass &= metric_pass;
+
+            wf::json_t m;
+            m["baseline"] = base;
+            m["current"]  = cur;
+            m["delta"]    = cur - base;
+            m["relative"] = (base > 0) ? (cur - base) / base : 0.0;
+            m["pass"]     = metric_pass;
+            metrics[name] = m;
+        }
+
+        wf::json_t result;
+        result["output"]  = current["output"];
+        result["pass"]    = pass;
+        result["metrics"] = metrics;
+        return result;
+    }
+
+    /**
+     * Compare the current statistics against the baseline in the file at the
+     * absolute @path, matching outputs by name. Outputs without a baseline are
+     * listed but do not affect the result.
+     */
+    wf::ipc::method_callback method_compare = [=] (const wf::json_t& data)
+    {
+        auto path = wf::ipc::json_get_string(data, "path");
+        double tolerance = wf::ipc::json_get_optional_double(data, "tolerance").value_or(0.1);
+
+        auto error = wf::check_client_path(path);
+        if (!error.empty())
+        {
+            return wf::ipc::json_error(error);
+        }
+
+        std::ifstream file{path};
+        if (!file)
+        {
+            return wf::ipc::json_error("failed to read " + path);
+        }
+
+        std::stringstream contents;
+        contents << file.rdbuf();
+
+        wf::json_t baseline;
+        if (auto error = wf::json_t::parse_string(contents.str(), baseline))
+        {
+            return wf::ipc::json_error("invalid baseline " + path + ": " + *error);
+        }
+
+        if (!baseline.is_object() || !baseline.has_member("outputs") || !baseline["outputs"].is_array())
+        {
+            return wf::ipc::json_error("invalid baseline " + path + ": no outputs");
+        }
+
+        for (size_t j = 0; j < baseline["outputs"].size(); j++)
+        {
+            auto error = validate_baseline_output(baseline["outputs"][j]);
+            if (!error.empty())
+            {
+                return wf::ipc::json_error("invalid baseline " + path + ": " + error);
+            }
+        }
+
+        if (baseline.has_member("name") && !baseline["name"].is_string())
+        {
+            return wf::ipc::json_error("invalid baseline " + path + ": \"name\" is not a string");
+        }
+
+        bool pass = true;
+        wf::json_t outputs   = wf::json_t::array();
+        wf::json_t unmatched = wf::json_t::array();
+        auto current = get_all_stats();
+        for (size_t i = 0; i < current.size(); i++)
+        {
+            bool found = false;
+            for (size_t j = 0; j < baseline["outputs"].size(); j++)
+            {
+                if (baseline["outputs"][j]["output"].as_string() == current[i]["output"].as_string())
+                {
+                    auto result = compare_output(baseline["outputs"][j], current[i], tolerance);
+                    pass &= result["pass"].as_bool();
+                    outputs.append(result);
+                    found = true;
+                    break;
+                }
+            }
+
+            if (!found)
+            {
+                unmatched.append(current[i]["output"]);
+            }
+        }
+
+        auto response = wf::ipc::json_ok();
+        response["baseline"]  = wf::ipc::json_get_optional_string(baseline, "name").value_or(path);
+        response["tolerance"] = tolerance;
+        response["pass"]      = pass;
+        response["outputs"]   = outputs;
+        response["unmatched"] = unmatched;
+        return response;
+    };
+
+    // The largest quad side accepted by ammen99/bench/stress
+    static constexpr int64_t MAX_STRESS_QUAD_SIZE = 4096;
+
+    /**
+     * Start, stop or query stress tests on all outputs, or only on "output".
+     *
+     * "start" adds "count" moving quads of "size" pixels with the damage
+     * "pattern" (moving or full). With "ramp", the load is changed every
+     * "step_duration" seconds until the maximum sustainable load is found.
+     * "count" and "size" are clamped to the supported range.
+     */
+    wf::ipc::method_callback method_stress = [=] (const wf::json_t& data)
+    {
+        auto action = wf::ipc::json_get_optional_string(data, "action").value_or("status");
+        if ((action != "start") && (action != "stop") && (action != "status"))
+        {
+            return wf::ipc::json_error("unknown action: " + action);
+        }
+
+        auto pattern_name = wf::ipc::json_get_optional_string(data, "pattern").value_or("moving");
+        if ((pattern_name != "moving") && (pattern_name != "full"))
+        {
+            return wf::ipc::json_error("unknown damage pattern: " + pattern_name);
+        }
+
+        double step_duration = wf::ipc::json_get_optional_double(data, "step_duration").value_or(2.0);
+        if (!(step_duration > 0))
+        {
+            return wf::ipc::json_error("step_duration must be positive");
+        }
+
+        auto pattern = (pattern_name == "full") ? stress_node_t::DAMAGE_FULL : stress_node_t::DAMAGE_MOVING;
+        int count = std::clamp<int64_t>(wf::ipc::json_get_optional_int64(data, "count").value_or(16),
+            1, wf::bench::load_ramp_t::MAX_LOAD);
+        int size = std::clamp<int64_t>(wf::ipc::json_get_optional_int64(data, "size").value_or(64),
+            1, MAX_STRESS_QUAD_SIZE);
+        bool ramp = wf::ipc::json_get_optional_bool(data, "ramp").value_or(true);
+        auto name = wf::ipc::json_get_optional_string(data, "output");
+
+        auto response = wf::ipc::json_ok();
+        response["outputs"] = wf::json_t::array();
+        for (auto& [wo, instance] : output_instance)
+        {
+            if (name && (wo->to_string() != *name))
+            {
+                continue;
+            }
+
+            if (action == "start")
+            {
+                instance->start_stress(count, pattern, size, ramp, step_duration);
+            } else if (action == "stop")
+            {
+                instance->stop_stress();
+            }
+
+            response["outputs"].append(instance->get_stress_json());
+        }
+
+        if (name && response["outputs"].size() == 0)
+        {
+            return wf::ipc::json_error("unknown output");
+        }
+
+        return response;
+    };
+
+    wf::signal::connection_t<wf::ipc::client_disconnected_signal> on_client_disconnected =
+        [=] (wf::ipc::client_disconnected_signal *ev)
+    {
+        watchers.erase(ev->client);
+        if (watchers.empty())
+        {
+            watch_timer.disconnect();
+        }
+    };
+};
+
+DECLARE_WAYFIRE_PLUGIN(wayfire_bench);
@@ -0,0 +1,432 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <wayfire/core.hpp>
+#include <wayfire/nonstd/json.hpp>
+#include <wayfire/plugins/ipc/ipc-method-repository.hpp>
+#include <wayfire/plugins/common/shared-core-data.hpp>
+#include "msgpack-writer.hpp"
+
+namespace wf
+{
+namespace binary_stream
+{
+inline void encode_msgpack(const wf::json_t& value, wf::msgpack::writer_t& out)
+{
+    if (value.is_null())
+    {
+        out.null();
+    } else if (value.is_bool())
+    {
+        out.value(value.as_bool());
+    } else if (value.is_uint64())
+    {
+        out.value(value.as_uint64());
+    } else if (value.is_int64())
+    {
+        out.value(value.as_int64());
+    } else if (value.is_double())
+    {
+        out.value(value.as_double());
+    } else if (value.is_string())
+    {
+        out.value(value.as_string());
+    } else if (value.is_array())
+    {
+        out.begin_array(value.size());
+        for (size_t i = 0; i < value.size(); i++)
+        {
+            encode_msgpack(value[i], out);
+        }
+    } else
+    {
+        auto names = value.get_member_names();
+        out.begin_map(names.size());
+        for (auto& name : names)
+        {
+            out.value(name);
+            encode_msgpack(value[name], out);
+        }
+    }
+}
+
+/** A frame of the side channel: a 4-byte little-endian length, then @event in MessagePack. */
+inline std::string encode_frame(const wf::json_t& event)
+{
+    std::string frame(4, '\0');
+    wf::msgpack::writer_t writer{frame};
+    encode_msgpack(event, writer);
+
+    uint32_t size = frame.size() - 4;
+    for (int i = 0; i < 4; i++)
+    {
+        frame[i] = (char)((size >> (8 * i)) & 0xff);
+    }
+
+    return frame;
+}
+
+/**
+ * Opt-in binary side channels for the events of the ammen99 plugins.
+ *
+ * Wayfire's IPC server frames and serializes every message on the IPC socket
+ * as JSON, so the binary events use a second socket:
+ *
+ * 1. The client calls ammen99/ipc/binary_stream on its IPC connection. The
+ *    reply contains the "path" of a unix socket and a one-time "token".
+ * 2. The client connects to the path and sends the token followed by '\n'.
+ * 3. From then on, the events which the plugins would send to the IPC
+ *    connection arrive on the side channel instead, each as a 4-byte
+ *    little-endian length followed by the event in MessagePack. Replies to
+ *    method calls stay on the IPC socket.
+ *
+ * When either connection is closed, the side channel is closed and events go
+ * to the IPC socket again. The same happens if the client stops reading and
+ * more than MAX_QUEUED bytes are waiting to be sent.
+ *
+ * The channels are shared between plugins with
+ * wf::shared_data::ref_ptr_t<wf::binary_stream::streams_t>.
+ */
+class streams_t
+{
+  public:
+    static constexpr size_t MAX_QUEUED = 16 << 20;
+    static constexpr size_t TOKEN_BYTES = 16;
+
+    streams_t()
+    {
+        repository->connect(&on_client_disconnected);
+    }
+
+    ~streams_t()
+    {
+        while (!connections.empty())
+        {
+            drop(connections.begin()->get());
+        }
+
+        if (listener_source)
+        {
+            wl_event_source_remove(listener_source);
+            ::close(listener_fd);
+            unlink(path.c_str());
+        }
+    }
+
+    /**
+     * Start a side channel for @client, replacing its current one. Sets @path
+     * and @token for the handshake. Returns an empty string on success, or an
+     * error message.
+     */
+    std::string open(wf::ipc::client_interface_t *client, std::string& path, std::string& token)
+    {
+        auto error = listen();
+        if (!error.empty())
+        {
+            return error;
+        }
+
+        uint8_t bytes[TOKEN_BYTES];
+        if (getrandom(bytes, sizeof(bytes), 0) != sizeof(bytes))
+        {
+            return std::string("failed to generate a token: ") + strerror(errno);
+        }
+
+        static constexpr char hex[] = "0123456789abcdef";
+        token.clear();
+        for (auto b : bytes)
+        {
+            token += hex[b >> 4];
+            token += hex[b & 15];
+        }
+
+        close(client);
+        tokens[client] = token;
+        path = this->path;
+        return "";
+    }
+
+    /** Close the side channel of @client, if it has one. */
+    void close(wf::ipc::client_interface_t *client)
+    {
+        tokens.erase(client);
+        if (auto connection = find(client))
+        {
+            drop(connection);
+        }
+    }
+
+    /** Send @event to each of @clients, on its side channel if it has one. */
+    template<class Container>
+    void send_event(const Container& clients, const wf::json_t& event)
+    {
+        // Encoded at most once, however many clients have a side channel
+        std::string frame;
+        for (auto& client : clients)
+        {
+            auto connection = find(client);
+            if (!connection)
+            {
+                client->send_json(event);
+                continue;
+            }
+
+            if (frame.empty())
+            {
+                frame = encode_frame(event);
+            }
+
+            if (!send(connection, frame))
+            {
+                client->send_json(event);
+            }
+        }
+    }
+
+    void send_event(wf::ipc::client_interface_t *client, const wf::json_t& event)
+    {
+        send_event(std::initializer_list<wf::ipc::client_interface_t*>{client}, event);
+    }
+
+  private:
+    /** An accepted connection, before (client is null) or after the handshake. */
+    struct connection_t
+    {
+        streams_t *self = nullptr;
+        int fd = -1;
+        wl_event_source *source = nullptr;
+        wf::ipc::client_interface_t *client = nullptr;
+        // The token received so far during the handshake
+        std::string received;
+        // The frames which the socket did not accept yet
+        std::string queued;
+    };
+
+    std::string listen()
+    {
+        if (listener_source)
+        {
+            return "";
+        }
+
+        const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+        if (!runtime_dir)
+        {
+            return "XDG_RUNTIME_DIR is not set";
+        }
+
+        path = std::string(runtime_dir) + "/wayfire-ammen99-" + std::to_string(getpid()) + ".sock";
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
+        {
+            return "socket path is too long: " + path;
+        }
+
+        strcpy(addr.sun_path, path.c_str());
+        listener_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listener_fd < 0)
+        {
+            return std::string("failed to create a socket: ") + strerror(errno);
+        }
+
+        // A leftover of an earlier compositor with the same pid
+        unlink(path.c_str());
+        if ((bind(listener_fd, (sockaddr*)&addr, sizeof(addr)) < 0) ||
+            (chmod(path.c_str(), 0600) < 0) || (::listen(listener_fd, 8) < 0))
+        {
+            std::string error = "failed to listen on " + path + ": " + strerror(errno);
+            ::close(listener_fd);
+            unlink(path.c_str());
+            return error;
+        }
+
+        listener_source = wl_event_loop_add_fd(wf::get_core().ev_loop, listener_fd, WL_EVENT_READABLE,
+            handle_listener, this);
+        return "";
+    }
+
+    static int handle_listener(int fd, uint32_t, void *data)
+    {
+        auto self = (streams_t*)data;
+        int conn_fd;
+        while ((conn_fd = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+        {
+            auto connection = std::make_unique<connection_t>();
+            connection->self = self;
+            connection->fd   = conn_fd;
+            connection->source = wl_event_loop_add_fd(wf::get_core().ev_loop, conn_fd, WL_EVENT_READABLE,
+                handle_connection, connection.get());
+            self->connections.push_back(std::move(connection));
+        }
+
+        return 0;
+    }
+
+    static int handle_connection(int, uint32_t mask, void *data)
+    {
+        auto connection = (connection_t*)data;
+        auto self = connection->self;
+        if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR))
+        {
+            self->drop(connection);
+            return 0;
+        }
+
+        if ((mask & WL_EVENT_WRITABLE) && !self->flush(connection))
+        {
+            return 0;
+        }
+
+        if (mask & WL_EVENT_READABLE)
+        {
+            char buffer[256];
+            ssize_t n = recv(connection->fd, buffer, sizeof(buffer), 0);
+            if ((n == 0) || ((n < 0) && (errno != EAGAIN) && (errno != EINTR)))
+            {
+                self->drop(connection);
+                return 0;
+            }
+
+            if (!connection->client && (n > 0))
+            {
+                // Anything sent after the handshake is ignored
+                connection->received.append(buffer, n);
+                self->handshake(connection);
+            }
+        }
+
+        return 0;
+    }
+
+    /** Match the token received on @connection with the token of an IPC client. */
+    void handshake(connection_t *connection)
+    {
+        auto end = connection->received.find('\n');
+        if (end == std::string::npos)
+        {
+            if (connection->received.size() > 2 * TOKEN_BYTES)
+            {
+                drop(connection);
+            }
+
+            return;
+        }
+
+        auto token = connection->received.substr(0, end);
+        for (auto it = tokens.begin(); it != tokens.end(); ++it)
+        {
+            if (it->second == token)
+            {
+                connection->client = it->first;
+                connection->received.clear();
+                tokens.erase(it);
+                return;
+            }
+        }
+
+        drop(connection);
+    }
+
+    connection_t *find(wf::ipc::client_interface_t *client)
+    {
+        if (!client)
+        {
+            return nullptr;
+        }
+
+        for (auto& connection : connections)
+        {
+            if (connection->client == client)
+            {
+                return connection.get();
+            }
+        }
+
+        return nullptr;
+    }
+
+    /** Queue @frame on @connection. Returns false if the connection was dropped. */
+    bool send(connection_t *connection, const std::string& frame)
+    {
+        if (connection->queued.size() + frame.size() > MAX_QUEUED)
+        {
+            drop(connection);
+            return false;
+        }
+
+        connection->queued += frame;
+        return flush(connection);
+    }
+
+    /** Write as much of the queued data as possible. Returns false if the connection was dropped. */
+    bool flush(connection_t *connection)
+    {
+        size_t done = 0;
+        while (done < connection->queued.size())
+        {
+            ssize_t n = ::send(connection->fd, connection->queued.data() + done,
+                connection->queued.size() - done, MSG_NOSIGNAL);
+            if (n >= 0)
+            {
+                done += n;
+            } else if (errno == EAGAIN)
+            {
+                break;
+            } else if (errno != EINTR)
+            {
+                drop(connection);
+                return false;
+            }
+        }
+
+        connection->queued.erase(0, done);
+        uint32_t mask = WL_EVENT_READABLE | (connection->queued.empty() ? 0 : WL_EVENT_WRITABLE);
+        wl_event_source_fd_update(connection->source, mask);
+        return true;
+    }
+
+    void drop(connection_t *connection)
+    {
+        wl_event_source_remove(connection->source);
+        ::close(connection->fd);
+        for (auto it = connections.begin(); it != connections.end(); ++it)
+        {
+            if (it->get() == connection)
+            {
+                connections.erase(it);
+                break;
+            }
+        }
+    }
+
+    std::string path;
+    int listener_fd = -1;
+    wl_event_source *listener_source = nullptr;
+    // Tokens handed out by open() which were not used yet
+    std::map<wf::ipc::client_interface_t*, std::string> tokens;
+    std::vector<std::unique_ptr<connection_t>> connections;
+
+    wf::shared_data::ref_ptr_t<wf::ipc::method_repository_t> repository;
+    wf::signal::connection_t<wf::ipc::client_disconnected_signal> on_client_disconnected =
+        [=] (wf::ipc::client_disconnected_signal *ev)
+    {
+        close(ev->client);
+    };
+};
+}
+}
@@ -1,5 +1,19 @@
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <unistd.h>
 #include <wayfire/config/option-types.hpp>
 #include <wayfire/nonstd/json.hpp>
 #include <wayfire/config/types.hpp>
@@ -17,46 +31,284 @@
 #include <wayfire/debug.hpp>
 #include <wayfire/plugins/common/cairo-util.hpp>
 #include <wayfire/scene-operations.hpp>
+#include <wayfire/signal-definitions.hpp>
+#include <wayfire/output.hpp>
+#include <wayfire/output-layout.hpp>
+#include <wayfire/per-output-plugin.hpp>
+#include <wayfire/render-manager.hpp>
+#include <wayfire/view.hpp>
+#include <wayfire/view-transform.hpp>
 #include <iostream>
 #include <deque>
+#include <list>
 #include <regex>
+#include <any>
+#include <bitset>
+#include "bench-stats.hpp"
+#include "binary-stream.hpp"
+#include "json-writer.hpp"
+#include "log-filter.hpp"
+#include "log-ring.hpp"
+#include "trace.hpp"
 
+/**
+ * A streambuf which calls a callback for each line written to it.
+ *
+ * Single characters go to a small put area, bulk writes are split on newlines
+ * directly. The line storage is reused, so capturing the log does not
+ * allocate once the longest line has been seen.
+ */
 class logger_streambuf_t : public std::streambuf
 {
   public:
-    using callback_t = std::function<void(std::string)>;
+    using callback_t = std::function<void(const std::string&)>;
     logger_streambuf_t(callback_t callback)
     {
         this->line_cb = callback;
+        setp(put_area.data(), put_area.data() + put_area.size());
     }
 
   protected:
+    std::streamsize xsputn(const char *s, std::streamsize n) override
+    {
+        drain_put_area();
+        consume(s, n);
+        return n;
+    }
+
     int_type overflow(int_type c) override
     {
+        drain_put_area();
         if (c != traits_type::eof())
         {
-            buffer += traits_type::to_char_type(c);
+            char ch = traits_type::to_char_type(c);
+            consume(&ch, 1);
         }
 
-        if (c == '\n' || c == traits_type::eof())
+        return traits_type::not_eof(c);
+    }
+
+    int sync() override
+    {
+        drain_put_area();
+        return 0;
+    }
+
+  private:
+    void drain_put_area()
+    {
+        consume(pbase(), pptr() - pbase());
+        setp(put_area.data(), put_area.data() + put_area.size());
+    }
+
+    void consume(const char *s, std::streamsize n)
+    {
+        const char *end = s + n;
+        while (s < end)
         {
-            if (c == '\n')
+            auto newline = (const char*)memchr(s, '\n', end - s);
+            if (!newline)
             {
-                buffer.pop_back();
+                line.append(s, end - s);
+                return;
             }
 
-            line_cb(buffer);
-            buffer.clear();
+            line.append(s, newline - s);
+            line_cb(line);
+            line.clear();
+            s = newline + 1;
         }
+    }
 
-        return traits_type::not_eof(c);
+    callback_t line_cb;
+    std::array<char, 256> put_area;
+    std::string line;
+};
+
+/**
+ * Writes log text to stdout on a separate thread, so that a slow terminal or
+ * pipe never blocks the main loop. Text is written in the order it was queued.
+ * If stdout falls behind by more than MAX_QUEUED bytes, new text is dropped
+ * and a marker line is written instead.
+ */
+class stdout_writer_t
+{
+  public:
+    static constexpr size_t MAX_QUEUED = 16 << 20;
+
+    ~stdout_writer_t()
+    {
+        stop();
+    }
+
+    /** Queue @text for writing. @text is left empty, reusing the capacity of an old buffer. */
+    void write(std::string& text)
+    {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            if (queued.size() + text.size() > MAX_QUEUED)
+            {
+                dropped = true;
+            } else
+            {
+                if (dropped)
+                {
+                    queued += "... log output dropped, stdout is too slow\n";
+                    dropped = false;
+                }
+
+                if (queued.empty())
+                {
+                    queued.swap(text);
+                } else
+                {
+                    queued += text;
+                }
+            }
+        }
+
+        text.clear();
+        if (!thread.joinable())
+        {
+            thread = std::thread([=] () { run(); });
+        }
+
+        cv.notify_one();
+    }
+
+    /** Wait until all queued text has been written and stop the thread. */
+    void stop()
+    {
+        if (!thread.joinable())
+        {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            stopping = true;
+        }
+
+        cv.notify_one();
+        thread.join();
+        stopping = false;
     }
 
   private:
-    callback_t line_cb;
-    std::string buffer;
+    void run()
+    {
+        std::string writing;
+        std::unique_lock<std::mutex> lock{mutex};
+        while (true)
+        {
+            cv.wait(lock, [=] () { return !queued.empty() || stopping; });
+            if (queued.empty())
+            {
+                return;
+            }
+
+            writing.swap(queued);
+            lock.unlock();
+            write_all(writing);
+            writing.clear();
+            lock.lock();
+        }
+    }
+
+    static void write_all(const std::string& text)
+    {
+        size_t done = 0;
+        while (done < text.size())
+        {
+            ssize_t n = ::write(STDOUT_FILENO, text.data() + done, text.size() - done);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+
+                return;
+            }
+
+            done += n;
+        }
+    }
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::string queued;
+    bool stopping = false;
+    bool dropped  = false;
+};
+
+/**
+ * Runs a callback repeatedly while it is armed, at most once every
+ * INTERVAL_MS, so that a long job is spread over many main loop iterations
+ * without keeping the loop busy in between.
+ *
+ * The first call happens when the loop is idle, i.e. after the current event,
+ * e.g. the IPC request which started the job, has been handled. After each
+ * call a timer arms the next idle call. The timer does not run the callback
+ * itself, so that the callback is free to re-arm or disconnect.
+ */
+class paced_call_t
+{
+  public:
+    static constexpr int INTERVAL_MS = 1;
+
+    void set_callback(std::function<void()> callback)
+    {
+        this->callback = std::move(callback);
+    }
+
+    void run()
+    {
+        if (armed)
+        {
+            return;
+        }
+
+        armed = true;
+        idle.run_once([=] () { call(); });
+    }
+
+    /** Stop calling the callback. Can be called from the callback itself. */
+    void disconnect()
+    {
+        armed = false;
+        idle.disconnect();
+        timer.disconnect();
+    }
+
+    bool is_connected() const
+    {
+        return armed;
+    }
+
+  private:
+    void call()
+    {
+        callback();
+        if (armed)
+        {
+            timer.set_timeout(INTERVAL_MS, [=] () { idle.run_once([=] () { call(); }); });
+        }
+    }
+
+    std::function<void()> callback;
+    wf::wl_idle_call idle;
+    wf::wl_timer<false> timer;
+    bool armed = false;
 };
 
+/**
+ * Shows the last log lines on an output, as many as fit in its geometry. Each
+ * line is rasterized once into its own texture; new lines are queued and added
+ * at most once per frame, so a burst of log messages does not re-render the
+ * overlay for every line.
+ */
 class output_log_overlay_t : public wf::scene::node_t
 {
     class output_log_render_instance_t : public wf::scene::simple_render_instance_t<output_log_overlay_t>
@@ -67,21 +319,27 @@ class output_log_overlay_t : public wf::scene::node_t
 #if WAYFIRE_API_ABI_VERSION_MACRO >= 2025'05'19
         void render(const wf::scene::render_instruction_t& data) override
         {
-            auto g = wf::construct_box(wf::origin(self->get_bounding_box()), self->text.get_size());
-            data.pass->add_rect(wf::color_t{0.01, 0.01, 0.01, 0.1}, data.target, g, data.damage);
-            data.pass->add_texture(self->text.get_texture(), data.target, g, data.damage);
+            data.pass->add_rect(wf::color_t{0.01, 0.01, 0.01, 0.1}, data.target, self->get_text_box(), data.damage);
+            for (size_t i = 0; i < self->lines.size(); i++)
+            {
+                data.pass->add_texture(self->lines[i]->get_texture(), data.target, self->get_line_box(i),
+                    data.damage);
+            }
         }
 #else
         void render(const wf::render_target_t& target, const wf::region_t& region) override
         {
             OpenGL::render_begin(target);
-            auto g = wf::construct_box(wf::origin(self->get_bounding_box()), self->text.get_size());
             for (auto box : region)
             {
                 target.logic_scissor(wlr_box_from_pixman_box(box));
-                OpenGL::render_rectangle(g, wf::color_t{0.01, 0.01, 0.01, 0.1}, target.get_orthographic_projection());
-                OpenGL::render_texture(self->text.tex.tex, target, g, glm::vec4(1.0f),
-                    OpenGL::TEXTURE_TRANSFORM_INVERT_Y);
+                OpenGL::render_rectangle(self->get_text_box(), wf::color_t{0.01, 0.01, 0.01, 0.1},
+                    target.get_orthographic_projection());
+                for (size_t i = 0; i < self->lines.size(); i++)
+                {
+                    OpenGL::render_texture(self->lines[i]->tex.tex, target, self->get_line_box(i),
+                        glm::vec4(1.0f), OpenGL::TEXTURE_TRANSFORM_INVERT_Y);
+                }
             }
 
             OpenGL::render_end();
@@ -89,12 +347,86 @@ class output_log_overlay_t : public wf::scene::node_t
 #endif
     };
 
-    std::deque<std::string> lines;
-    wf::cairo_text_t text;
+    static constexpr int FONT_SIZE = 12;
+
+    // The rasterized lines, oldest first
+    std::deque<std::unique_ptr<wf::cairo_text_t>> lines;
+    // Lines added since the last frame
+    std::deque<std::string> pending;
+    int line_height = wf::cairo_text_t::measure_height(FONT_SIZE);
+
+    size_t get_max_lines()
+    {
+        return std::max(1, get_bounding_box().height / line_height);
+    }
+
+    wf::geometry_t get_line_box(size_t i)
+    {
+        auto box = get_bounding_box();
+        return wf::construct_box({box.x, box.y + (int)i * line_height}, lines[i]->get_size());
+    }
+
+    wf::geometry_t get_text_box()
+    {
+        int width = 0;
+        for (auto& line : lines)
+        {
+            width = std::max(width, line->get_size().width);
+        }
+
+        auto box = get_bounding_box();
+        return {box.x, box.y, width, (int)lines.size() * line_height};
+    }
+
+    /** Rasterize the pending lines, reusing the textures of lines which scroll out. */
+    wf::effect_hook_t flush_pending = [=] ()
+    {
+        if (pending.empty())
+        {
+            return;
+        }
+
+        wf::cairo_text_t::params params;
+        params.text_color = wf::color_t{0.5, 0.5, 0.5, 1};
+        params.font_size  = FONT_SIZE;
+        params.rounded_rect = false;
+        params.bg_rect  = false;
+        params.max_size = {get_bounding_box().width, line_height};
+
+        auto damage = get_text_box();
+        for (auto& line : pending)
+        {
+            std::unique_ptr<wf::cairo_text_t> text;
+            if (lines.size() >= get_max_lines())
+            {
+                text = std::move(lines.front());
+                lines.pop_front();
+            } else
+            {
+                text = std::make_unique<wf::cairo_text_t>();
+            }
+
+            text->render_text(line, params);
+            lines.push_back(std::move(text));
+        }
+
+        pending.clear();
+        wf::scene::damage_node(shared_from_this(), wf::region_t{damage} | get_text_box());
+    };
 
   public:
-    output_log_overlay_t() : node_t(false)
-    {}
+    wf::output_t *const output;
+
+    output_log_overlay_t(wf::output_t *output) : node_t(false), output(output)
+    {
+        output->render->add_effect(&flush_pending, wf::OUTPUT_EFFECT_DAMAGE);
+        output->connect(&on_output_changed);
+    }
+
+    ~output_log_overlay_t()
+    {
+        output->render->rem_effect(&flush_pending);
+    }
 
     void gen_render_instances(std::vector<wf::scene::render_instance_uptr>& instances,
         wf::scene::damage_callback push_damage, wf::output_t *output) override
@@ -104,131 +436,2009 @@ class output_log_overlay_t : public wf::scene::node_t
 
     wf::geometry_t get_bounding_box() override
     {
-        auto outputs = wf::get_core().output_layout->get_outputs();
-        if (outputs.empty())
-        {
-            return {0, 0, 1280, 720};
-        } else
-        {
-            auto og = outputs.front()->get_layout_geometry();
-            return {og.x, og.y, 1280, 720};
-        }
+        return output->get_layout_geometry();
     }
 
-    void add_line(std::string line)
+    /** Drop the oldest lines which no longer fit after the output was resized. */
+    wf::signal::connection_t<wf::output_configuration_changed_signal> on_output_changed = [=] (auto)
     {
-        lines.push_back(line);
-
-        const size_t max_lines = get_bounding_box().height / wf::cairo_text_t::measure_height(12);
-        while (lines.size() > max_lines)
+        while (lines.size() > get_max_lines())
         {
             lines.pop_front();
         }
 
-        std::string full_txt;
-        for (auto& line : lines)
+        wf::scene::damage_node(shared_from_this(), get_bounding_box());
+    };
+
+    void add_line(const std::string& line)
+    {
+        if (pending.empty())
         {
-            full_txt += line;
-            full_txt += '\n';
+            output->render->schedule_redraw();
         }
 
-        wf::cairo_text_t::params params;
-        params.text_color = wf::color_t{0.5, 0.5, 0.5, 1};
-        params.font_size = 12;
-        params.rounded_rect = false;
-        params.bg_rect = false;
-        params.max_size = wf::dimensions(get_bounding_box());
+        // Lines which would scroll out before the next frame are never rasterized
+        if (pending.size() >= get_max_lines())
+        {
+            pending.pop_front();
+        }
 
-        text.render_text(full_txt, params);
-        wf::scene::damage_node(this->shared_from_this(), get_bounding_box());
+        pending.push_back(line);
     }
 };
 
-class wayfire_ipc_debugger : public wf::plugin_interface_t
+/**
+ * An overlay which shows the recently repainted regions of all outputs,
+ * fading out over time.
+ */
+class damage_heatmap_t : public wf::scene::node_t
 {
-    std::regex filter{""};
-    logger_streambuf_t::callback_t log_callback = [&] (std::string line)
+    class heatmap_render_instance_t : public wf::scene::simple_render_instance_t<damage_heatmap_t>
     {
-        if (std::regex_match(line, filter))
+      public:
+        using simple_render_instance_t::simple_render_instance_t;
+
+#if WAYFIRE_API_ABI_VERSION_MACRO >= 2025'05'19
+        void render(const wf::scene::render_instruction_t& data) override
+        {
+            for (size_t i = 0; i < self->heat.size(); i++)
+            {
+                float a = self->get_intensity(self->heat[i]);
+                data.pass->add_rect(wf::color_t{a, 0, 0, a}, data.target, self->heat[i].box, data.damage);
+            }
+        }
+
+#else
+        void render(const wf::render_target_t& target, const wf::region_t& region) override
         {
-            std::cout << line << std::endl;
-            overlay->add_line(line);
+            OpenGL::render_begin(target);
+            for (auto box : region)
+            {
+                target.logic_scissor(wlr_box_from_pixman_box(box));
+                for (size_t i = 0; i < self->heat.size(); i++)
+                {
+                    float a = self->get_intensity(self->heat[i]);
+                    OpenGL::render_rectangle(self->heat[i].box, wf::color_t{a, 0, 0, a},
+                        target.get_orthographic_projection());
+                }
+            }
+
+            OpenGL::render_end();
         }
+#endif
     };
 
-    logger_streambuf_t logstream{log_callback};
-    std::ostream logger{&logstream};
+    struct heat_t
+    {
+        wf::geometry_t box;
+        uint32_t time;
+    };
 
-    std::shared_ptr<output_log_overlay_t> overlay;
-    wf::shared_data::ref_ptr_t<wf::ipc::method_repository_t> repository;
+    static constexpr uint32_t LIFETIME_MS = 2000;
+    static constexpr float MAX_INTENSITY  = 0.4;
+
+    wf::bench::ring_buffer_t<heat_t> heat{1024};
+    wf::wl_timer<true> decay_timer;
+
+    float get_intensity(const heat_t& h)
+    {
+        uint32_t age = wf::get_current_time() - h.time;
+        return MAX_INTENSITY * (1.0 - std::min(age, LIFETIME_MS) / float(LIFETIME_MS));
+    }
+
+    void damage_heat()
+    {
+        wf::region_t damage;
+        for (size_t i = 0; i < heat.size(); i++)
+        {
+            damage |= heat[i].box;
+        }
+
+        self_damage |= damage;
+        wf::scene::damage_node(shared_from_this(), damage);
+    }
 
   public:
-    void init() override
+    /**
+     * Damage caused by the heatmap itself (in layout coordinates), which should
+     * not be recorded as damage by anyone else.
+     */
+    wf::region_t self_damage;
+
+    damage_heatmap_t() : node_t(false)
+    {}
+
+    ~damage_heatmap_t()
     {
-        repository->register_method("ammen99/debug/filter", method_set_filter);
-        repository->register_method("ammen99/debug/stop_log", method_stop_log);
-        repository->register_method("ammen99/debug/scenedump", method_dump_scenegraph);
+        decay_timer.disconnect();
     }
 
-    wf::ipc::method_callback method_set_filter = [=] (const wf::json_t& data)
+    void gen_render_instances(std::vector<wf::scene::render_instance_uptr>& instances,
+        wf::scene::damage_callback push_damage, wf::output_t *output) override
     {
-        this->filter = wf::ipc::json_get_string(data, "filter");
+        instances.push_back(std::make_unique<heatmap_render_instance_t>(this, push_damage, output));
+    }
 
-        // Add overlay
-        if (!overlay)
+    wf::geometry_t get_bounding_box() override
+    {
+        wf::region_t all;
+        for (auto& wo : wf::get_core().output_layout->get_outputs())
         {
-            overlay = std::make_shared<output_log_overlay_t>();
-            wf::scene::add_front(wf::get_core().scene(), overlay);
+            all |= wo->get_layout_geometry();
         }
 
-        // Enable all logs
-        wf::log::enabled_categories.reset();
-        wf::log::enabled_categories.flip();
+        return wlr_box_from_pixman_box(all.get_extents());
+    }
+
+    /** Add a repainted box (in layout coordinates). */
+    void add(wf::geometry_t box)
+    {
+        if (heat.full())
+        {
+            heat.pop_front();
+        }
 
-        // Redirect to custom logging
-        wf::log::initialize_logging(logger, wf::log::LOG_LEVEL_DEBUG, wf::log::LOG_COLOR_MODE_OFF);
+        heat.push_back({box, wf::get_current_time()});
+        if (!decay_timer.is_connected())
+        {
+            decay_timer.set_timeout(100, [=] ()
+            {
+                while (!heat.empty() && (wf::get_current_time() - heat.front().time >= LIFETIME_MS))
+                {
+                    heat.pop_front();
+                }
 
-        return wf::ipc::json_ok();
-    };
+                damage_heat();
+                return !heat.empty();
+            });
+        }
+    }
+};
 
-    wf::ipc::method_callback method_stop_log = [=] (auto)
+/** Tracks the damage of each frame of an output. */
+class output_damage_tracker_t : public wf::per_output_plugin_instance_t
+{
+  public:
+    std::shared_ptr<damage_heatmap_t> heatmap;
+
+    uint64_t frames = 0;
+    uint64_t full_frames = 0;
+    double area_sum  = 0;
+    double ratio_sum = 0;
+    double ratio_max = 0;
+    uint64_t rects_sum = 0;
+
+    void init() override
     {
-        // Stop logging
-        wf::log::initialize_logging(std::cout, wf::log::LOG_LEVEL_INFO, wf::log::LOG_COLOR_MODE_OFF);
-        wf::log::enabled_categories.reset();
+        output->render->add_effect(&damage_hook, wf::OUTPUT_EFFECT_DAMAGE);
+    }
+
+    void fini() override
+    {
+        output->render->rem_effect(&damage_hook);
+    }
+
+    void reset()
+    {
+        frames   = full_frames = rects_sum = 0;
+        area_sum = ratio_sum = ratio_max = 0;
+    }
 
-        // Disable overlay
-        if (overlay)
+    wf::json_t to_json()
+    {
+        wf::json_t js;
+        js["output"]      = output->to_string();
+        js["frames"]      = frames;
+        js["full-frames"] = full_frames;
+        js["mean-area"]   = frames ? area_sum / frames : 0.0;
+        js["mean-rects"]  = frames ? rects_sum / (double)frames : 0.0;
+        js["mean-ratio"]  = frames ? ratio_sum / frames : 0.0;
+        js["max-ratio"]   = ratio_max;
+        return js;
+    }
+
+  private:
+    wf::effect_hook_t damage_hook = [=] ()
+    {
+        auto og     = output->get_layout_geometry();
+        auto damage = output->render->get_scheduled_damage();
+        if (heatmap)
         {
-            wf::scene::remove_child(overlay);
-            overlay.reset();
+            // Do not count the repaints of the heatmap itself
+            wf::region_t own = heatmap->self_damage & og;
+            heatmap->self_damage ^= og;
+            own += wf::point_t{-og.x, -og.y};
+            damage ^= own;
         }
 
-        return wf::ipc::json_ok();
+        if (damage.empty())
+        {
+            return;
+        }
+
+        double area = 0;
+        uint64_t rects = 0;
+        for (auto& box : damage)
+        {
+            area += double(box.x2 - box.x1) * (box.y2 - box.y1);
+            ++rects;
+            if (heatmap)
+            {
+                heatmap->add({box.x1 + og.x, box.y1 + og.y, box.x2 - box.x1, box.y2 - box.y1});
+            }
+        }
+
+        double ratio = area / std::max(1.0, double(og.width) * og.height);
+        ++frames;
+        full_frames += (ratio >= 0.99);
+        area_sum    += area;
+        rects_sum   += rects;
+        ratio_sum   += ratio;
+        ratio_max    = std::max(ratio_max, ratio);
     };
+};
 
-    wf::json_t dump_scenegraph(wf::scene::node_ptr root)
+/**
+ * A pass-through view transformer which measures the CPU time spent in
+ * schedule_instructions() and render() of everything below it.
+ */
+class render_profile_node_t : public wf::scene::transformer_base_node_t
+{
+    class profiled_render_instance_t : public wf::scene::render_instance_t
     {
-        wf::json_t result;
+        render_profile_node_t *self;
+        std::vector<wf::scene::render_instance_uptr> children;
 
-        result["name"] = root->stringify();
-        result["local-bbox"] = wf::ipc::geometry_to_json(root->get_bounding_box());
+#if WAYFIRE_API_ABI_VERSION_MACRO >= 2025'05'19
+        /**
+         * Instructions of the children are redirected through us, so that we
+         * can time them. The instruction only carries the index of the child's
+         * instance and data in this list, which keeps its capacity between
+         * passes, so redirecting does not allocate.
+         */
+        struct wrapped_instruction_t
+        {
+            wf::scene::render_instance_t *instance;
+            std::any data;
+        };
 
-        std::stringstream ss;
-        ss << root.get();
-        result["id"] = ss.str();
-        result["children"] = wf::json_t::array();
-        for (auto& ch : root->get_children())
+        std::vector<wrapped_instruction_t> wrapped;
+#endif
+
+      public:
+        profiled_render_instance_t(render_profile_node_t *self, wf::scene::damage_callback push_damage,
+            wf::output_t *output)
         {
-            result["children"].append(dump_scenegraph(ch));
+            this->self = self;
+            for (auto& ch : self->get_children())
+            {
+                if (ch->is_enabled())
+                {
+                    ch->gen_render_instances(children, push_damage, output);
+                }
+            }
         }
 
-        return result;
-    }
+        void schedule_instructions(std::vector<wf::scene::render_instruction_t>& instructions,
+            const wf::render_target_t& target, wf::region_t& damage) override
+        {
+            uint64_t start = wf::bench::get_current_time_ns();
+            self->begin_pass();
 
-    wf::ipc::method_callback method_dump_scenegraph = [=] (auto)
-    {
-        return dump_scenegraph(wf::get_core().scene());
+            size_t first = instructions.size();
+            for (auto& ch : children)
+            {
+                ch->schedule_instructions(instructions, target, damage);
+            }
+
+#if WAYFIRE_API_ABI_VERSION_MACRO >= 2025'05'19
+            // The instructions of the previous pass have been rendered already
+            wrapped.clear();
+            for (size_t i = first; i < instructions.size(); i++)
+            {
+                auto& instr = instructions[i];
+                wrapped.push_back({instr.instance, std::move(instr.data)});
+                instr.data     = wrapped.size() - 1;
+                instr.instance = this;
+            }
+
+#else
+            // Without access to the instruction data in render(), only scheduling is timed.
+            (void)first;
+#endif
+            self->add_cost(wf::bench::get_current_time_ns() - start);
+        }
+
+#if WAYFIRE_API_ABI_VERSION_MACRO >= 2025'05'19
+        void render(const wf::scene::render_instruction_t& data) override
+        {
+            uint64_t start = wf::bench::get_current_time_ns();
+            auto& child    = wrapped[std::any_cast<size_t>(data.data)];
+
+            // The instruction is owned by the render pass and not const itself.
+            // Redirect it to the child in place instead of copying its damage
+            // and data, and restore it afterwards.
+            auto& instr = const_cast<wf::scene::render_instruction_t&>(data);
+            instr.instance = child.instance;
+            std::swap(instr.data, child.data);
+            child.instance->render(instr);
+            std::swap(instr.data, child.data);
+            instr.instance = this;
+            self->add_cost(wf::bench::get_current_time_ns() - start);
+        }
+
+#else
+        void render(const wf::render_target_t&, const wf::region_t&) override
+        {}
+#endif
+
+        void compute_visibility(wf::output_t *output, wf::region_t& visible) override
+        {
+            for (auto& ch : children)
+            {
+                ch->compute_visibility(output, visible);
+            }
+        }
+
+        wf::scene::direct_scanout try_scanout(wf::output_t *output) override
+        {
+            for (auto& ch : children)
+            {
+                auto result = ch->try_scanout(output);
+                if (result != wf::scene::direct_scanout::SKIP)
+                {
+                    return result;
+                }
+            }
+
+            return wf::scene::direct_scanout::SKIP;
+        }
+
+        void presentation_feedback(wf::output_t *output) override
+        {
+            for (auto& ch : children)
+            {
+                ch->presentation_feedback(output);
+            }
+        }
+    };
+
+  public:
+    // Total time, number of passes (schedule_instructions calls) and time of the last pass
+    uint64_t total_ns  = 0;
+    uint64_t passes    = 0;
+    uint64_t last_pass_ns = 0;
+
+    render_profile_node_t() : transformer_base_node_t(false)
+    {}
+
+    std::string stringify() const override
+    {
+        return "render-profile " + stringify_flags();
+    }
+
+    void gen_render_instances(std::vector<wf::scene::render_instance_uptr>& instances,
+        wf::scene::damage_callback push_damage, wf::output_t *output) override
+    {
+        instances.push_back(std::make_unique<profiled_render_instance_t>(this, push_damage, output));
+    }
+
+    wf::geometry_t get_bounding_box() override
+    {
+        return get_children_bounding_box();
+    }
+
+    void begin_pass()
+    {
+        ++passes;
+        last_pass_ns = 0;
+    }
+
+    void add_cost(uint64_t ns)
+    {
+        total_ns     += ns;
+        last_pass_ns += ns;
+    }
+
+    void reset()
+    {
+        total_ns = passes = last_pass_ns = 0;
+    }
+};
+
+/**
+ * Stable ids and change generations for the nodes of the scenegraph.
+ *
+ * The first sync() indexes the whole scene. After that, the index listens to
+ * each node's damage and children-list changes and marks the node dirty, and
+ * sync() only compares the dirty nodes with their indexed state. New and
+ * changed nodes get the next generation, so clients can ask for only the nodes
+ * which changed after a generation they have already seen.
+ *
+ * When nobody needs updates, unwatch() disconnects from all nodes but keeps
+ * the ids and generations. The next sync() then compares every node again.
+ */
+class scene_index_t
+{
+  public:
+    struct change_record_t
+    {
+        uint64_t generation;
+        uint32_t changes;
+    };
+
+    // Change flags are kept per generation for this many generations of a
+    // node, older ones are merged together
+    static constexpr size_t MAX_HISTORY = 8;
+
+    /** Marks the node dirty when it is damaged or its children change. */
+    struct watch_t
+    {
+        wf::signal::connection_t<wf::scene::node_damage_signal> on_damage;
+        wf::signal::connection_t<wf::scene::node_regen_instances_signal> on_regen;
+    };
+
+    struct node_info_t
+    {
+        uint64_t id;
+        // The generation in which the node itself last changed
+        uint64_t generation;
+        // The highest generation of the node and all its descendants
+        uint64_t subtree_generation;
+        // What changed in the recent generations of the node, oldest first
+        std::vector<change_record_t> history;
+        // The changes dropped from the history, and the newest generation among them
+        uint32_t older_changes = 0;
+        uint64_t older_generation = 0;
+        std::weak_ptr<wf::scene::node_t> node;
+        uint64_t parent = 0;
+
+        std::string name;
+        wf::geometry_t bbox;
+        bool enabled;
+        std::vector<uint64_t> children;
+
+        std::unique_ptr<watch_t> watch;
+
+        /** What changed in the node after generation @since, see change_t. */
+        uint32_t changes_since(uint64_t since) const
+        {
+            uint32_t changes = (older_generation > since) ? older_changes : 0;
+            for (auto& record : history)
+            {
+                changes |= (record.generation > since) ? record.changes : 0;
+            }
+
+            return changes;
+        }
+    };
+
+    enum change_t : uint32_t
+    {
+        CHANGE_ADDED    = (1 << 0),
+        CHANGE_NAME     = (1 << 1),
+        CHANGE_BBOX     = (1 << 2),
+        CHANGE_ENABLED  = (1 << 3),
+        CHANGE_CHILDREN = (1 << 4),
+        CHANGE_PARENT   = (1 << 5),
+    };
+
+    struct removed_node_t
+    {
+        uint64_t id;
+        uint64_t generation;
+    };
+
+    // Removed nodes are remembered for diffs, up to this many
+    static constexpr size_t MAX_REMOVED = 4096;
+
+    /** The generation of the last change anywhere in the scene. */
+    uint64_t generation = 0;
+
+    /** Called when the first node is marked dirty after a sync(). */
+    std::function<void()> on_dirty;
+
+    bool has_dirty() const
+    {
+        return !dirty.empty();
+    }
+
+    /**
+     * Bring the index up to date. The first call indexes the whole scene below
+     * @root, later calls only update the dirty nodes and their new subtrees.
+     */
+    void sync(wf::scene::node_ptr root)
+    {
+        uint64_t candidate = generation + 1;
+        syncing = true;
+        if (!watching)
+        {
+            // Changes were not tracked since unwatch(), check every live node
+            for (auto& [node, info] : nodes)
+            {
+                if (auto ptr = info.node.lock(); ptr.get() == node)
+                {
+                    watch(info, ptr);
+                    dirty.insert(node);
+                }
+            }
+
+            watching = true;
+        }
+
+        if (!nodes.count(root.get()))
+        {
+            add_subtree(root, 0, candidate);
+        }
+
+        // Updating a node can mark more nodes dirty, e.g. the parent of a node
+        // whose bounding box changed
+        std::vector<std::pair<wf::scene::node_t*, uint64_t>> orphans;
+        while (!dirty.empty())
+        {
+            auto batch = std::move(dirty);
+            dirty.clear();
+            for (auto node : batch)
+            {
+                auto it = nodes.find(node);
+                auto ptr = (it == nodes.end()) ? nullptr : it->second.node.lock();
+                if (ptr.get() == node)
+                {
+                    // Destroyed nodes are removed when their parent is updated
+                    update_node(it->second, ptr, candidate, orphans);
+                }
+            }
+        }
+
+        // A child which left its parent is removed, unless another node adopted it
+        for (auto& [node, old_parent] : orphans)
+        {
+            auto it = nodes.find(node);
+            if ((it != nodes.end()) && (it->second.parent == old_parent))
+            {
+                remove_subtree(it->second.id, candidate);
+            }
+        }
+
+        for (auto node : touched)
+        {
+            propagate_subtree_generation(node, candidate);
+        }
+
+        if (!touched.empty() || removed_in_sync)
+        {
+            generation = candidate;
+        }
+
+        touched.clear();
+        removed_in_sync = false;
+        syncing = false;
+    }
+
+    /** Stop listening to the nodes until the next sync(). */
+    void unwatch()
+    {
+        for (auto& [node, info] : nodes)
+        {
+            info.watch.reset();
+        }
+
+        dirty.clear();
+        watching = false;
+    }
+
+    /** Find a node seen in the last sync() by its id. */
+    const node_info_t *find(uint64_t id) const
+    {
+        auto it = by_id.find(id);
+        return (it == by_id.end()) ? nullptr : &nodes.at(it->second);
+    }
+
+    const node_info_t *find(wf::scene::node_t *node) const
+    {
+        auto it = nodes.find(node);
+        return (it == nodes.end()) ? nullptr : &it->second;
+    }
+
+    /**
+     * The nodes removed after generation @since. Returns false if some of them
+     * are no longer remembered, in which case the client has to fetch the whole
+     * scene again.
+     */
+    bool get_removed(uint64_t since, std::vector<uint64_t>& ids) const
+    {
+        for (auto& r : removed)
+        {
+            if (r.generation > since)
+            {
+                ids.push_back(r.id);
+            }
+        }
+
+        return since >= forgotten_generation;
+    }
+
+  private:
+    void mark_dirty(wf::scene::node_t *node)
+    {
+        if (dirty.insert(node).second && (dirty.size() == 1) && !syncing && on_dirty)
+        {
+            on_dirty();
+        }
+    }
+
+    /** Index @node and all of its descendants as new nodes. */
+    uint64_t add_subtree(const wf::scene::node_ptr& node, uint64_t parent, uint64_t candidate)
+    {
+        auto it = nodes.find(node.get());
+        if (it != nodes.end())
+        {
+            // The address was reused by a new node before the old one was removed
+            remove_subtree(it->second.id, candidate);
+        }
+
+        auto& info = nodes.emplace(node.get(), node_info_t{}).first->second;
+        info.id     = next_id++;
+        info.node   = node;
+        info.parent = parent;
+        info.name   = node->stringify();
+        info.bbox   = node->get_bounding_box();
+        info.enabled = node->is_enabled();
+        by_id[info.id] = node.get();
+        watch(info, node);
+
+        // References to map elements stay valid while children are inserted
+        info.subtree_generation = candidate;
+        for (auto& ch : node->get_children())
+        {
+            info.children.push_back(add_subtree(ch, info.id, candidate));
+        }
+
+        record_change(info, CHANGE_ADDED, candidate);
+        return info.id;
+    }
+
+    void watch(node_info_t& info, const wf::scene::node_ptr& node)
+    {
+        auto raw = node.get();
+        info.watch = std::make_unique<watch_t>();
+        info.watch->on_damage.set_callback([=] (wf::scene::node_damage_signal*) { mark_dirty(raw); });
+        info.watch->on_regen.set_callback([=] (wf::scene::node_regen_instances_signal*) { mark_dirty(raw); });
+        node->connect(&info.watch->on_damage);
+        node->connect(&info.watch->on_regen);
+    }
+
+    /** Compare @node with its indexed state, adding and orphaning children as needed. */
+    void update_node(node_info_t& info, const wf::scene::node_ptr& node, uint64_t candidate,
+        std::vector<std::pair<wf::scene::node_t*, uint64_t>>& orphans)
+    {
+        auto name = node->stringify();
+        auto bbox = node->get_bounding_box();
+        bool enabled = node->is_enabled();
+        uint32_t changes = ((info.name != name) ? CHANGE_NAME : 0) |
+            ((info.bbox != bbox) ? CHANGE_BBOX : 0) |
+            ((info.enabled != enabled) ? CHANGE_ENABLED : 0);
+
+        info.name    = std::move(name);
+        info.bbox    = bbox;
+        info.enabled = enabled;
+
+        std::vector<uint64_t> children;
+        for (auto& ch : node->get_children())
+        {
+            auto it = nodes.find(ch.get());
+            if ((it == nodes.end()) || (it->second.node.lock() != ch))
+            {
+                children.push_back(add_subtree(ch, info.id, candidate));
+                continue;
+            }
+
+            auto& child = it->second;
+            if (child.parent != info.id)
+            {
+                // Moved here from another parent
+                child.parent = info.id;
+                record_change(child, CHANGE_PARENT, candidate);
+            }
+
+            children.push_back(child.id);
+        }
+
+        if (info.children != children)
+        {
+            changes |= CHANGE_CHILDREN;
+            for (auto id : info.children)
+            {
+                auto it = by_id.find(id);
+                if ((it != by_id.end()) && (std::find(children.begin(), children.end(), id) == children.end()))
+                {
+                    orphans.push_back({it->second, info.id});
+                }
+            }
+
+            info.children = std::move(children);
+        }
+
+        if (changes & CHANGE_BBOX)
+        {
+            // The bounding box of a container depends on its children
+            if (auto parent = node->parent())
+            {
+                mark_dirty(parent);
+            }
+        }
+
+        record_change(info, changes, candidate);
+    }
+
+    void record_change(node_info_t& info, uint32_t changes, uint64_t candidate)
+    {
+        if (!changes)
+        {
+            return;
+        }
+
+        if (info.history.size() == MAX_HISTORY)
+        {
+            info.older_changes   |= info.history.front().changes;
+            info.older_generation = info.history.front().generation;
+            info.history.erase(info.history.begin());
+        }
+
+        info.history.push_back({candidate, changes});
+        info.generation = candidate;
+        touched.push_back(info.id);
+    }
+
+    /** Raise the subtree generation of the node with @id and its ancestors. */
+    void propagate_subtree_generation(uint64_t id, uint64_t candidate)
+    {
+        auto it = by_id.find(id);
+        while (it != by_id.end())
+        {
+            auto& info = nodes.at(it->second);
+            if ((info.subtree_generation == candidate) && (info.id != id))
+            {
+                // The rest of the path was raised already
+                break;
+            }
+
+            info.subtree_generation = candidate;
+            it = by_id.find(info.parent);
+        }
+    }
+
+    void remove_subtree(uint64_t id, uint64_t candidate)
+    {
+        auto it = by_id.find(id);
+        if (it == by_id.end())
+        {
+            return;
+        }
+
+        auto node_it = nodes.find(it->second);
+        for (auto child : node_it->second.children)
+        {
+            auto child_info = find(child);
+            if (child_info && (child_info->parent == id))
+            {
+                remove_subtree(child, candidate);
+            }
+        }
+
+        dirty.erase(it->second);
+        nodes.erase(node_it);
+        by_id.erase(it);
+        add_removed(id, candidate);
+        removed_in_sync = true;
+    }
+
+    void add_removed(uint64_t id, uint64_t generation)
+    {
+        if (removed.size() == MAX_REMOVED)
+        {
+            forgotten_generation = removed.front().generation;
+            removed.pop_front();
+        }
+
+        removed.push_back({id, generation});
+    }
+
+    std::unordered_map<wf::scene::node_t*, node_info_t> nodes;
+    std::unordered_map<uint64_t, wf::scene::node_t*> by_id;
+    std::unordered_set<wf::scene::node_t*> dirty;
+    std::deque<removed_node_t> removed;
+    // Nodes which changed in the current sync()
+    std::vector<uint64_t> touched;
+    bool removed_in_sync = false;
+    bool syncing = false;
+    // Whether the indexed nodes are watched, see unwatch()
+    bool watching = true;
+    uint64_t forgotten_generation = 0;
+    uint64_t next_id = 1;
+};
+
+class wayfire_ipc_debugger : public wf::plugin_interface_t,
+    public wf::per_output_tracker_mixin_t<output_damage_tracker_t>
+{
+    wf::log_filter::filter_t filter;
+    logger_streambuf_t::callback_t log_callback = [&] (const std::string& line)
+    {
+        auto start = std::chrono::steady_clock::now();
+        ++log_lines;
+        if (filter.match(line))
+        {
+            ++log_matched;
+            if (log_to_stdout)
+            {
+                stdout_buffer.append(line);
+                stdout_buffer += '\n';
+                schedule_log_flush();
+            }
+
+            if (log_ring)
+            {
+                log_ring->write_line(line);
+            }
+
+            if (!log_subscribers.empty())
+            {
+                if (log_batch.size() < MAX_LOG_BATCH)
+                {
+                    log_batch.push_back(line);
+                } else
+                {
+                    ++log_batch_dropped;
+                }
+
+                schedule_log_flush();
+            }
+
+            for (auto& [wo, overlay] : overlays)
+            {
+                overlay->add_line(line);
+            }
+        }
+
+        log_sink_time += std::chrono::steady_clock::now() - start;
+    };
+
+    // Lines which reached the sink, i.e. were formatted, since the last reset
+    uint64_t log_lines   = 0;
+    uint64_t log_matched = 0;
+    std::chrono::steady_clock::duration log_sink_time{0};
+    std::chrono::steady_clock::time_point log_stats_start = std::chrono::steady_clock::now();
+
+    /**
+     * Matched lines are collected and, at most LOG_FLUSH_MS after the first
+     * one, handed to the stdout writer thread and sent to IPC subscribers in a
+     * batch. The ring file is written directly.
+     */
+    static constexpr int LOG_FLUSH_MS = 50;
+    static constexpr size_t MAX_LOG_BATCH = 10000;
+
+    bool log_to_stdout = true;
+    std::string stdout_buffer;
+    stdout_writer_t stdout_writer;
+    // The ring file the matched lines are written to, if any
+    std::unique_ptr<wf::log_ring::ring_file_t> log_ring;
+
+    std::set<wf::ipc::client_interface_t*> log_subscribers;
+    std::vector<std::string> log_batch;
+    uint64_t log_batch_dropped = 0;
+    wf::wl_timer<false> log_flush_timer;
+
+    /** Arm the flush timer, unless a flush is already pending. */
+    void schedule_log_flush()
+    {
+        if (!log_flush_timer.is_connected())
+        {
+            log_flush_timer.set_timeout(LOG_FLUSH_MS, [=] () { flush_log(); });
+        }
+    }
+
+    void flush_log()
+    {
+        log_flush_timer.disconnect();
+        if (!stdout_buffer.empty())
+        {
+            stdout_writer.write(stdout_buffer);
+        }
+
+        if (log_batch.empty() && !log_batch_dropped)
+        {
+            return;
+        }
+
+        wf::json_t event;
+        event["event"]   = "ammen99/debug/log";
+        event["lines"]   = wf::json_t::array();
+        event["dropped"] = log_batch_dropped;
+        for (auto& line : log_batch)
+        {
+            event["lines"].append(line);
+        }
+
+        // Sending may log, which appends to the next batch
+        log_batch.clear();
+        log_batch_dropped = 0;
+        streams->send_event(log_subscribers, event);
+    }
+
+    logger_streambuf_t logstream{log_callback};
+    std::ostream logger{&logstream};
+
+    // The log overlays, one per output while logging is active
+    std::map<wf::output_t*, std::shared_ptr<output_log_overlay_t>> overlays;
+    wf::shared_data::ref_ptr_t<wf::ipc::method_repository_t> repository;
+    wf::shared_data::ref_ptr_t<wf::trace::recorder_t> tracer;
+    wf::shared_data::ref_ptr_t<wf::binary_stream::streams_t> streams;
+
+  public:
+    void init() override
+    {
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/debug/filter", method_set_filter);
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/debug/filter_bench", method_filter_bench);
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/debug/stop_log", method_stop_log);
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/debug/log_subscribe", method_log_subscribe);
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/debug/log_gate", method_log_gate);
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/debug/log_stats", method_log_stats);
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/debug/scenedump", method_dump_scenegraph);
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/debug/scene_subscribe", method_scene_subscribe);
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/debug/render_profile", method_render_profile);
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/debug/damage_stats", method_damage_stats);
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/debug/trace_start", method_trace_start);
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/debug/trace_stop", method_trace_stop);
+        repository->connect(&on_client_disconnected);
+        scene_stream_call.set_callback([=] () { send_scene_chunks(); });
+        scene_index.on_dirty = [=] () { schedule_scene_changes(); };
+    }
+
+    void fini() override
+    {
+        repository->unregister_method("ammen99/debug/filter");
+        repository->unregister_method("ammen99/debug/filter_bench");
+        repository->unregister_method("ammen99/debug/stop_log");
+        repository->unregister_method("ammen99/debug/log_subscribe");
+        repository->unregister_method("ammen99/debug/log_gate");
+        repository->unregister_method("ammen99/debug/log_stats");
+        repository->unregister_method("ammen99/debug/scenedump");
+        repository->unregister_method("ammen99/debug/scene_subscribe");
+        repository->unregister_method("ammen99/debug/render_profile");
+        repository->unregister_method("ammen99/debug/damage_stats");
+        repository->unregister_method("ammen99/debug/trace_start");
+        repository->unregister_method("ammen99/debug/trace_stop");
+        set_render_profiling(false);
+        set_damage_tracking(false, false);
+        if (logging_active)
+        {
+            // wf::log must not write to this plugin's logger after it is unloaded
+            stop_logging();
+        }
+
+        log_flush_timer.disconnect();
+        scene_stream_call.disconnect();
+        scene_notify_timer.disconnect();
+        scene_index.on_dirty = nullptr;
+        remove_log_overlays();
+    }
+
+    bool damage_tracking = false;
+    std::shared_ptr<damage_heatmap_t> heatmap;
+
+    void handle_new_output(wf::output_t *output) override
+    {
+        per_output_tracker_mixin_t::handle_new_output(output);
+        output_instance[output]->heatmap = heatmap;
+    }
+
+    void set_damage_tracking(bool enabled, bool show_heatmap)
+    {
+        if (show_heatmap && !heatmap)
+        {
+            heatmap = std::make_shared<damage_heatmap_t>();
+            wf::scene::add_front(wf::get_core().scene(), heatmap);
+        } else if (!show_heatmap && heatmap)
+        {
+            wf::scene::remove_child(heatmap);
+            heatmap.reset();
+        }
+
+        if (enabled != damage_tracking)
+        {
+            damage_tracking = enabled;
+            if (enabled)
+            {
+                init_output_tracking();
+            } else
+            {
+                fini_output_tracking();
+            }
+        }
+
+        for (auto& [wo, tracker] : output_instance)
+        {
+            tracker->heatmap = heatmap;
+        }
+    }
+
+    /**
+     * Enable or disable recording the damage of each frame, and get a summary
+     * of the recorded damage for each output.
+     */
+    wf::ipc::method_callback method_damage_stats = [=] (const wf::json_t& data)
+    {
+        if (data.has_member("enable"))
+        {
+            bool enable = wf::ipc::json_get_bool(data, "enable");
+            bool show_heatmap = enable && data.has_member("heatmap") && wf::ipc::json_get_bool(data, "heatmap");
+            set_damage_tracking(enable, show_heatmap);
+        }
+
+        auto response = wf::ipc::json_ok();
+        response["enabled"] = damage_tracking;
+        response["outputs"] = wf::json_t::array();
+        for (auto& [wo, tracker] : output_instance)
+        {
+            response["outputs"].append(tracker->to_json());
+            if (data.has_member("reset") && wf::ipc::json_get_bool(data, "reset"))
+            {
+                tracker->reset();
+            }
+        }
+
+        return response;
+    };
+
+    /**
+     * Start recording a binary trace of the ammen99 plugins into a memory-mapped
+     * ring file at the absolute @path, see trace.hpp for the format.
+     */
+    wf::ipc::method_callback method_trace_start = [=] (const wf::json_t& data)
+    {
+        auto path = wf::ipc::json_get_string(data, "path");
+        uint64_t capacity = 1 << 20;
+        if (data.has_member("capacity"))
+        {
+            capacity = wf::ipc::json_get_uint64(data, "capacity");
+        }
+
+        auto error = tracer->start(path, capacity);
+        if (!error.empty())
+        {
+            return wf::ipc::json_error(error);
+        }
+
+        return wf::ipc::json_ok();
+    };
+
+    wf::ipc::method_callback method_trace_stop = [=] (auto)
+    {
+        auto response = wf::ipc::json_ok();
+        response["records"] = tracer->recorded();
+        tracer->stop();
+        return response;
+    };
+
+    struct log_level_info_t
+    {
+        // The first character of lines with this level
+        char prefix;
+        wf::log::log_level_t level;
+    };
+
+    static inline const std::map<std::string, log_level_info_t> log_levels = {
+        {"debug", {'D', wf::log::LOG_LEVEL_DEBUG}},
+        {"info", {'I', wf::log::LOG_LEVEL_INFO}},
+        {"warn", {'W', wf::log::LOG_LEVEL_WARN}},
+        {"error", {'E', wf::log::LOG_LEVEL_ERROR}},
+    };
+
+    // The same names as for Wayfire's -d option
+    static inline const std::map<std::string, wf::log::logging_category> log_categories = {
+        {"txn", wf::log::logging_category::TXN},
+        {"txni", wf::log::logging_category::TXNI},
+        {"views", wf::log::logging_category::VIEWS},
+        {"wlroots", wf::log::logging_category::WLR},
+        {"damage", wf::log::logging_category::DAMAGE},
+        {"scanout", wf::log::logging_category::SCANOUT},
+        {"pointer", wf::log::logging_category::POINTER},
+        {"wset", wf::log::logging_category::WSET},
+        {"kbd", wf::log::logging_category::KBD},
+        {"xwayland", wf::log::logging_category::XWL},
+        {"layer-shell", wf::log::logging_category::LSHELL},
+        {"im", wf::log::logging_category::IM},
+        {"render", wf::log::logging_category::RENDER},
+    };
+
+    /**
+     * Which messages wf::log formats at all. Messages below the level or in a
+     * disabled category are dropped before they are formatted, unlike those
+     * rejected by the filter.
+     */
+    struct log_gate_t
+    {
+        std::string level = "debug";
+        decltype(wf::log::enabled_categories) categories;
+    };
+
+    bool logging_active = false;
+    log_gate_t log_gate;
+
+    /**
+     * Read the gate from "level" and "categories" (a list of category names,
+     * all categories by default). Returns an error message if they are invalid.
+     */
+    static std::string parse_log_gate(const wf::json_t& data, log_gate_t& gate)
+    {
+        gate.level = wf::ipc::json_get_optional_string(data, "level").value_or("debug");
+        if (!log_levels.count(gate.level))
+        {
+            return "unknown level: " + gate.level;
+        }
+
+        if (!data.has_member("categories"))
+        {
+            gate.categories.set();
+            return "";
+        }
+
+        if (!data["categories"].is_array())
+        {
+            return "categories must be a list of names";
+        }
+
+        gate.categories.reset();
+        for (size_t i = 0; i < data["categories"].size(); i++)
+        {
+            std::string name = data["categories"][i].is_string() ? data["categories"][i].as_string() : "";
+            if (!log_categories.count(name))
+            {
+                return "unknown category: " + name;
+            }
+
+            gate.categories.set((size_t)log_categories.at(name));
+        }
+
+        return "";
+    }
+
+    void apply_log_gate(const log_gate_t& gate)
+    {
+        log_gate = gate;
+        wf::log::enabled_categories = gate.categories;
+        wf::log::initialize_logging(logger, log_levels.at(gate.level).level, wf::log::LOG_COLOR_MODE_OFF);
+    }
+
+    /**
+     * Send wf::log back to stdout. The lines collected so far are written out
+     * first, so that none of them are lost or end up after newer output.
+     */
+    void stop_logging()
+    {
+        wf::log::initialize_logging(std::cout, wf::log::LOG_LEVEL_INFO, wf::log::LOG_COLOR_MODE_OFF);
+        wf::log::enabled_categories.reset();
+        logging_active = false;
+
+        flush_log();
+        stdout_writer.stop();
+        log_ring.reset();
+    }
+
+    /**
+     * Compile a filter from the IPC request: "filter" is a regex which must
+     * match the whole line, "level" (debug, info, warn or error) is the minimum
+     * level, "file" a part of the source file name and "category" the exact
+     * logging category.
+     */
+    static std::string compile_filter(wf::log_filter::filter_t& filter, const wf::json_t& data)
+    {
+        auto level = wf::ipc::json_get_optional_string(data, "level").value_or("debug");
+        if (!log_levels.count(level))
+        {
+            return "unknown level: " + level;
+        }
+
+        return filter.compile(wf::ipc::json_get_string(data, "filter"), log_levels.at(level).prefix,
+            wf::ipc::json_get_optional_string(data, "file").value_or(""),
+            wf::ipc::json_get_optional_string(data, "category").value_or(""));
+    }
+
+    wf::ipc::method_callback method_set_filter = [=] (const wf::json_t& data)
+    {
+        wf::log_filter::filter_t compiled;
+        log_gate_t gate;
+        auto error = compile_filter(compiled, data);
+        if (error.empty())
+        {
+            error = parse_log_gate(data, gate);
+        }
+
+        if (!error.empty())
+        {
+            return wf::ipc::json_error(error);
+        }
+
+        bool to_stdout = wf::ipc::json_get_optional_bool(data, "stdout").value_or(true);
+        std::unique_ptr<wf::log_ring::ring_file_t> ring;
+        if (auto path = wf::ipc::json_get_optional_string(data, "ring"))
+        {
+            uint64_t size = wf::ipc::json_get_optional_uint64(data, "ring_size").value_or(4 << 20);
+            ring  = std::make_unique<wf::log_ring::ring_file_t>();
+            error = ring->open(*path, size);
+            if (!error.empty())
+            {
+                return wf::ipc::json_error(error);
+            }
+        }
+
+        // Everything is valid, nothing changes if the request fails above
+        this->filter = std::move(compiled);
+        this->log_to_stdout = to_stdout;
+        this->log_ring = std::move(ring);
+
+        add_log_overlays();
+
+        // Redirect to custom logging. Earlier output is still buffered in std::cout,
+        // while the stdout writer writes to the file descriptor directly.
+        std::cout.flush();
+        apply_log_gate(gate);
+        logging_active = true;
+        return wf::ipc::json_ok();
+    };
+
+    /** Change the level and categories while logging, keeping the filter. */
+    wf::ipc::method_callback method_log_gate = [=] (const wf::json_t& data)
+    {
+        if (!logging_active)
+        {
+            return wf::ipc::json_error("logging is not started, use ammen99/debug/filter");
+        }
+
+        log_gate_t gate;
+        auto error = parse_log_gate(data, gate);
+        if (!error.empty())
+        {
+            return wf::ipc::json_error(error);
+        }
+
+        apply_log_gate(gate);
+        return wf::ipc::json_ok();
+    };
+
+    /**
+     * Report how many lines were formatted and matched since the last reset,
+     * and the time spent filtering and writing them.
+     */
+    wf::ipc::method_callback method_log_stats = [=] (const wf::json_t& data)
+    {
+        using namespace std::chrono;
+        double elapsed = duration<double>(steady_clock::now() - log_stats_start).count();
+
+        auto response = wf::ipc::json_ok();
+        response["active"]     = logging_active;
+        response["level"]      = log_gate.level;
+        response["categories"] = wf::json_t::array();
+        for (auto& [name, category] : log_categories)
+        {
+            if (log_gate.categories[(size_t)category])
+            {
+                response["categories"].append(name);
+            }
+        }
+
+        response["elapsed"] = elapsed;
+        response["lines"]   = log_lines;
+        response["matched"] = log_matched;
+        response["sink-ms"] = duration<double, std::milli>(log_sink_time).count();
+        response["lines-per-second"] = log_lines / std::max(elapsed, 1e-9);
+
+        if (wf::ipc::json_get_optional_bool(data, "reset").value_or(false))
+        {
+            log_lines   = 0;
+            log_matched = 0;
+            log_sink_time   = {};
+            log_stats_start = steady_clock::now();
+        }
+
+        return response;
+    };
+
+    // The benchmark runs on the main loop, so it must stay short
+    static constexpr int MAX_FILTER_BENCH_LINES = 200'000;
+
+    /**
+     * Measure how many lines per second a filter processes, compared to
+     * std::regex_match on every line, using up to MAX_FILTER_BENCH_LINES
+     * synthetic log lines.
+     */
+    wf::ipc::method_callback method_filter_bench = [=] (const wf::json_t& data)
+    {
+        wf::log_filter::filter_t bench_filter;
+        auto error = compile_filter(bench_filter, data);
+        if (!error.empty())
+        {
+            return wf::ipc::json_error(error);
+        }
+
+        static const char *templates[] = {
+            "DD 17-10-25 12:00:00.000 - [src/core/txn/transaction-manager.cpp:%d] [TXN] Committing transaction %d",
+            "DD 17-10-25 12:00:00.000 - [src/view/xdg-shell.cpp:%d] [VIEWS] Set geometry of view %d",
+            "DD 17-10-25 12:00:00.000 - [src/core/seat/pointer.cpp:%d] [POINTER] Motion on surface %d",
+            "II 17-10-25 12:00:00.000 - [src/output/render-manager.cpp:%d] Output frame %d",
+            "WW 17-10-25 12:00:00.000 - [plugins/ipc/ipc.cpp:%d] Client %d sent an invalid message",
+        };
+
+        int count = std::clamp<int64_t>(wf::ipc::json_get_optional_int64(data, "lines").value_or(100'000),
+            1, MAX_FILTER_BENCH_LINES);
+        std::vector<std::string> lines;
+        lines.reserve(count);
+        char buf[256];
+        for (int i = 0; i < count; i++)
+        {
+            snprintf(buf, sizeof(buf), templates[i % std::size(templates)], i % 1000 + 1, i);
+            lines.push_back(buf);
+        }
+
+        // Compiled like the regex of the filter, so that only the matching differs
+        std::regex regex{wf::ipc::json_get_string(data, "filter"), std::regex::ECMAScript | std::regex::optimize};
+        auto measure = [&] (auto&& match)
+        {
+            size_t matched = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (auto& line : lines)
+            {
+                matched += match(line);
+            }
+
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            wf::json_t result;
+            result["matched"] = (uint64_t)matched;
+            result["lines-per-second"] = lines.size() / std::max(elapsed.count(), 1e-9);
+            return result;
+        };
+
+        auto response = wf::ipc::json_ok();
+        response["lines"]      = (uint64_t)lines.size();
+        response["uses-regex"] = bench_filter.uses_regex();
+        response["prefilter"]  = wf::json_t::array();
+        for (auto& literal : bench_filter.required_literals())
+        {
+            response["prefilter"].append(literal);
+        }
+
+        response["filter"] = measure([&] (const std::string& line) { return bench_filter.match(line); });
+        response["regex"]  = measure([&] (const std::string& line) { return std::regex_match(line, regex); });
+        return response;
+    };
+
+    wf::ipc::method_callback method_stop_log = [=] (auto)
+    {
+        stop_logging();
+        remove_log_overlays();
+        return wf::ipc::json_ok();
+    };
+
+    /**
+     * Subscribe the client to the lines matched by the filter. They are sent in
+     * batches as {"event": "ammen99/debug/log", "lines": [...], "dropped": N}.
+     */
+    wf::ipc::method_callback_full method_log_subscribe = [=] (const wf::json_t&, wf::ipc::client_interface_t *client)
+    {
+        if (!client)
+        {
+            return wf::ipc::json_error("log_subscribe can only be used by IPC clients");
+        }
+
+        log_subscribers.insert(client);
+        return wf::ipc::json_ok();
+    };
+
+    wf::signal::connection_t<wf::ipc::client_disconnected_signal> on_client_disconnected =
+        [=] (wf::ipc::client_disconnected_signal *ev)
+    {
+        log_subscribers.erase(ev->client);
+        remove_scene_subscriber(ev->client);
+        for (auto& stream : scene_streams)
+        {
+            if (stream.client == ev->client)
+            {
+                stream.client = nullptr;
+                stream.stack.clear();
+            }
+        }
+    };
+
+    void add_log_overlay(wf::output_t *output)
+    {
+        auto overlay = std::make_shared<output_log_overlay_t>(output);
+        wf::scene::add_front(wf::get_core().scene(), overlay);
+        overlays[output] = overlay;
+    }
+
+    void remove_log_overlay(wf::output_t *output)
+    {
+        auto it = overlays.find(output);
+        if (it != overlays.end())
+        {
+            wf::scene::remove_child(it->second);
+            overlays.erase(it);
+        }
+    }
+
+    /** Show the log overlay on all current outputs and on outputs added later. */
+    void add_log_overlays()
+    {
+        if (on_output_added.is_connected())
+        {
+            return;
+        }
+
+        for (auto& output : wf::get_core().output_layout->get_outputs())
+        {
+            add_log_overlay(output);
+        }
+
+        wf::get_core().output_layout->connect(&on_output_added);
+        wf::get_core().output_layout->connect(&on_output_removed);
+    }
+
+    void remove_log_overlays()
+    {
+        on_output_added.disconnect();
+        on_output_removed.disconnect();
+        while (!overlays.empty())
+        {
+            remove_log_overlay(overlays.begin()->first);
+        }
+    }
+
+    wf::signal::connection_t<wf::output_added_signal> on_output_added = [=] (wf::output_added_signal *ev)
+    {
+        add_log_overlay(ev->output);
+    };
+
+    wf::signal::connection_t<wf::output_removed_signal> on_output_removed = [=] (wf::output_removed_signal *ev)
+    {
+        remove_log_overlay(ev->output);
+    };
+
+    scene_index_t scene_index;
+
+    wf::json_t node_to_json(const scene_index_t::node_info_t& info)
+    {
+        wf::json_t result;
+        result["name"] = info.name;
+        result["id"]   = info.id;
+        result["parent"]     = info.parent;
+        result["generation"] = info.generation;
+        result["subtree-generation"] = info.subtree_generation;
+        result["local-bbox"] = wf::ipc::geometry_to_json(info.bbox);
+        result["enabled"]    = info.enabled;
+        return result;
+    }
+
+    /** Dump the subtree of @info down to @depth levels below it, or all of it if @depth is negative. */
+    wf::json_t dump_scenegraph(const scene_index_t::node_info_t& info, int depth)
+    {
+        auto result = node_to_json(info);
+        result["child-count"] = (uint64_t)info.children.size();
+        result["children"]    = wf::json_t::array();
+        if (depth != 0)
+        {
+            for (auto id : info.children)
+            {
+                result["children"].append(dump_scenegraph(*scene_index.find(id), depth - 1));
+            }
+        }
+
+        return result;
+    }
+
+    /**
+     * Append the nodes of the subtree of @info which changed after generation
+     * @since to @changed, each with the ids of its children instead of nesting.
+     */
+    void dump_changes(const scene_index_t::node_info_t& info, uint64_t since, int depth, wf::json_t& changed)
+    {
+        if (info.subtree_generation <= since)
+        {
+            return;
+        }
+
+        if (info.generation > since)
+        {
+            auto node = node_to_json(info);
+            node["children"] = wf::json_t::array();
+            for (auto id : info.children)
+            {
+                node["children"].append(id);
+            }
+
+            node["changes"] = changes_to_json(info.changes_since(since));
+            changed.append(node);
+        }
+
+        if (depth != 0)
+        {
+            for (auto id : info.children)
+            {
+                dump_changes(*scene_index.find(id), since, depth - 1, changed);
+            }
+        }
+    }
+
+    bool render_profiling = false;
+
+    wf::signal::connection_t<wf::view_mapped_signal> on_view_mapped = [=] (wf::view_mapped_signal *ev)
+    {
+        add_render_profiler(ev->view);
+    };
+
+    void add_render_profiler(wayfire_view view)
+    {
+        auto tmanager = view->get_transformed_node();
+        if (!tmanager->get_transformer<render_profile_node_t>())
+        {
+            // Above all other transformers, so that their cost is included as well
+            tmanager->add_transformer(std::make_shared<render_profile_node_t>(), wf::TRANSFORMER_BLUR + 1);
+        }
+    }
+
+    void set_render_profiling(bool enabled)
+    {
+        if (enabled == render_profiling)
+        {
+            return;
+        }
+
+        render_profiling = enabled;
+        for (auto& view : wf::get_core().get_all_views())
+        {
+            if (enabled)
+            {
+                add_render_profiler(view);
+            } else
+            {
+                view->get_transformed_node()->rem_transformer<render_profile_node_t>();
+            }
+        }
+
+        if (enabled)
+        {
+            wf::get_core().connect(&on_view_mapped);
+        } else
+        {
+            on_view_mapped.disconnect();
+        }
+    }
+
+    /**
+     * Dump the scenegraph with the render cost (in milliseconds) of each node,
+     * including all of its children. The total cost is the CPU time since
+     * profiling was enabled, and the per-frame cost is the average of each
+     * render pass.
+     */
+    wf::json_t dump_render_profile(wf::scene::node_ptr root, bool reset)
+    {
+        wf::json_t result;
+        result["name"] = root->stringify();
+        result["local-bbox"] = wf::ipc::geometry_to_json(root->get_bounding_box());
+
+        auto info = scene_index.find(root.get());
+        result["id"] = info ? info->id : 0;
+
+        double total = 0, per_frame = 0, last_frame = 0;
+        if (auto profiler = dynamic_cast<render_profile_node_t*>(root.get()))
+        {
+            total      = profiler->total_ns / 1e6;
+            per_frame  = profiler->passes ? profiler->total_ns / 1e6 / profiler->passes : 0;
+            last_frame = profiler->last_pass_ns / 1e6;
+            if (reset)
+            {
+                profiler->reset();
+            }
+        }
+
+        result["children"] = wf::json_t::array();
+        for (auto& ch : root->get_children())
+        {
+            auto child = dump_render_profile(ch, reset);
+            if (!dynamic_cast<render_profile_node_t*>(root.get()))
+            {
+                // Profilers already include the cost of their children
+                total      += child["cost-total"].as_double();
+                per_frame  += child["cost-per-frame"].as_double();
+                last_frame += child["cost-last-frame"].as_double();
+            }
+
+            result["children"].append(child);
+        }
+
+        result["cost-total"]      = total;
+        result["cost-per-frame"]  = per_frame;
+        result["cost-last-frame"] = last_frame;
+        return result;
+    }
+
+    wf::ipc::method_callback method_render_profile = [=] (const wf::json_t& data)
+    {
+        if (data.has_member("enable"))
+        {
+            set_render_profiling(wf::ipc::json_get_bool(data, "enable"));
+        }
+
+        bool reset = data.has_member("reset") && wf::ipc::json_get_bool(data, "reset");
+
+        scene_index.sync(wf::get_core().scene());
+        auto response = wf::ipc::json_ok();
+        response["enabled"] = render_profiling;
+        response["scene"]   = dump_render_profile(wf::get_core().scene(), reset);
+        release_scene_index();
+        return response;
+    };
+
+    /**
+     * A scene dump which is serialized in chunks of at most SCENE_CHUNK_SIZE
+     * bytes, each sent as an event, so that dumping a large scene neither
+     * builds the whole tree in memory nor blocks the main loop.
+     *
+     * The scene index can be synced again while a stream is running, so each
+     * node is written as it is when the stream reaches it, and its children
+     * are copied at that point. Children which were removed before the stream
+     * reached them are written as null.
+     */
+    struct scene_stream_t
+    {
+        struct frame_t
+        {
+            uint64_t id;
+            // The next child to dump, or NOT_STARTED before the node itself was written
+            size_t next_child;
+            int depth;
+            // The children of the node when it was written
+            std::vector<uint64_t> children;
+        };
+
+        static constexpr size_t NOT_STARTED = -1;
+
+        wf::ipc::client_interface_t *client;
+        uint64_t id;
+        uint64_t seq = 0;
+        std::vector<frame_t> stack;
+        std::string buffer;
+        wf::json_stream::json_writer_t writer{buffer};
+    };
+
+    static constexpr size_t SCENE_CHUNK_SIZE = 64 * 1024;
+
+    std::list<scene_stream_t> scene_streams;
+    uint64_t next_scene_stream = 1;
+    paced_call_t scene_stream_call;
+
+    /** Send one chunk of each stream, see paced_call_t for how often. */
+    void send_scene_chunks()
+    {
+        for (auto& stream : scene_streams)
+        {
+            if (stream.client)
+            {
+                send_scene_chunk(stream);
+            }
+        }
+
+        scene_streams.remove_if([] (const scene_stream_t& stream) { return stream.stack.empty(); });
+        if (scene_streams.empty())
+        {
+            scene_stream_call.disconnect();
+            release_scene_index();
+        }
+    }
+
+    wf::json_t start_scene_stream(wf::ipc::client_interface_t *client,
+        const scene_index_t::node_info_t& root, int depth)
+    {
+        auto& stream = scene_streams.emplace_back();
+        stream.client = client;
+        stream.id     = next_scene_stream++;
+        stream.stack.push_back({root.id, scene_stream_t::NOT_STARTED, depth});
+
+        scene_stream_call.run();
+
+        auto response = wf::ipc::json_ok();
+        response["stream"] = stream.id;
+        response["scene-generation"] = scene_index.generation;
+        return response;
+    }
+
+    /** Serialize the next part of the scene and send it to the client. */
+    void send_scene_chunk(scene_stream_t& stream)
+    {
+        auto& w = stream.writer;
+        while (!stream.stack.empty() && (stream.buffer.size() < SCENE_CHUNK_SIZE))
+        {
+            auto& frame = stream.stack.back();
+            if (frame.next_child == scene_stream_t::NOT_STARTED)
+            {
+                auto info = scene_index.find(frame.id);
+                if (!info)
+                {
+                    w.null();
+                    stream.stack.pop_back();
+                    continue;
+                }
+
+                w.begin_object();
+                w.member("name", info->name);
+                w.member("id", info->id);
+                w.member("parent", info->parent);
+                w.member("generation", info->generation);
+                w.member("subtree-generation", info->subtree_generation);
+                w.key("local-bbox");
+                w.begin_object();
+                w.member("x", info->bbox.x);
+                w.member("y", info->bbox.y);
+                w.member("width", info->bbox.width);
+                w.member("height", info->bbox.height);
+                w.end_object();
+                w.member("child-count", info->children.size());
+                w.key("children");
+                w.begin_array();
+                frame.next_child = 0;
+                if (frame.depth != 0)
+                {
+                    frame.children = info->children;
+                }
+            }
+
+            if (frame.next_child < frame.children.size())
+            {
+                // Pushing invalidates the reference to the frame
+                uint64_t child = frame.children[frame.next_child++];
+                int depth = frame.depth - 1;
+                stream.stack.push_back({child, scene_stream_t::NOT_STARTED, depth});
+                continue;
+            }
+
+            w.end_array();
+            w.end_object();
+            stream.stack.pop_back();
+        }
+
+        wf::json_t event;
+        event["event"]  = "ammen99/debug/scenedump";
+        event["stream"] = stream.id;
+        event["seq"]    = stream.seq++;
+        event["data"]   = stream.buffer;
+        event["done"]   = stream.stack.empty();
+        streams->send_event(stream.client, event);
+        stream.buffer.clear();
+    }
+
+    /**
+     * Dump the scenegraph, or the subtree of the node with the id "root", down
+     * to "depth" levels below it. With "since", only the nodes which changed
+     * after that generation are returned, together with the removed node ids.
+     * With "stream", the tree is sent in chunks, see scene_stream_t.
+     */
+    wf::ipc::method_callback_full method_dump_scenegraph = [=] (const wf::json_t& data,
+                                                               wf::ipc::client_interface_t *client)
+    {
+        scene_index.sync(wf::get_core().scene());
+
+        auto root = scene_index.find(wf::get_core().scene().get());
+        if (data.has_member("root"))
+        {
+            root = scene_index.find(wf::ipc::json_get_uint64(data, "root"));
+            if (!root)
+            {
+                release_scene_index();
+                return wf::ipc::json_error("no such node");
+            }
+        }
+
+        int depth = wf::ipc::json_get_optional_int64(data, "depth").value_or(-1);
+        if (wf::ipc::json_get_optional_bool(data, "stream").value_or(false))
+        {
+            if (!client)
+            {
+                release_scene_index();
+                return wf::ipc::json_error("streaming is only possible for IPC clients");
+            }
+
+            return start_scene_stream(client, *root, depth);
+        }
+
+        if (!data.has_member("since"))
+        {
+            auto result = dump_scenegraph(*root, depth);
+            result["scene-generation"] = scene_index.generation;
+            release_scene_index();
+            return result;
+        }
+
+        uint64_t since = wf::ipc::json_get_uint64(data, "since");
+        wf::json_t changed = wf::json_t::array();
+        dump_changes(*root, since, depth, changed);
+
+        std::vector<uint64_t> removed_ids;
+        bool complete = scene_index.get_removed(since, removed_ids);
+        wf::json_t removed = wf::json_t::array();
+        for (auto id : removed_ids)
+        {
+            removed.append(id);
+        }
+
+        auto response = wf::ipc::json_ok();
+        response["generation"] = scene_index.generation;
+        response["changed"]    = changed;
+        response["removed"]    = removed;
+        response["complete"]   = complete;
+        release_scene_index();
+        return response;
+    };
+
+    static wf::json_t changes_to_json(uint32_t changes)
+    {
+        static const std::pair<uint32_t, const char*> names[] = {
+            {scene_index_t::CHANGE_ADDED, "added"},
+            {scene_index_t::CHANGE_NAME, "name"},
+            {scene_index_t::CHANGE_BBOX, "bbox"},
+            {scene_index_t::CHANGE_ENABLED, "enabled"},
+            {scene_index_t::CHANGE_CHILDREN, "children"},
+            {scene_index_t::CHANGE_PARENT, "parent"},
+        };
+
+        wf::json_t result = wf::json_t::array();
+        for (auto& [flag, name] : names)
+        {
+            if (changes & flag)
+            {
+                result.append(name);
+            }
+        }
+
+        return result;
+    }
+
+    /**
+     * Clients subscribed with scene_subscribe get an event with the nodes which
+     * changed since the last event, in the same format as scenedump with
+     * "since". Nodes which the scene index marks dirty only schedule an event,
+     * so that all changes within one frame are sent together, and sending it
+     * only looks at those nodes.
+     */
+    std::set<wf::ipc::client_interface_t*> scene_subscribers;
+    uint64_t scene_sent_generation = 0;
+    wf::wl_timer<false> scene_notify_timer;
+
+    /** The shortest refresh interval of all outputs in milliseconds. */
+    static int get_min_frame_time()
+    {
+        int max_refresh_mhz = 0;
+        for (auto& output : wf::get_core().output_layout->get_outputs())
+        {
+            max_refresh_mhz = std::max(max_refresh_mhz, output->handle->refresh);
+        }
+
+        // Fall back to 60Hz if no output reports a refresh rate
+        max_refresh_mhz = max_refresh_mhz > 0 ? max_refresh_mhz : 60'000;
+        return std::max(1, 1'000'000 / max_refresh_mhz);
+    }
+
+    /** Called when a node of the scene index becomes dirty. */
+    void schedule_scene_changes()
+    {
+        if (!scene_subscribers.empty() && !scene_notify_timer.is_connected())
+        {
+            scene_notify_timer.set_timeout(get_min_frame_time(), [=] () { send_scene_changes(); });
+        }
+    }
+
+    void send_scene_changes()
+    {
+        scene_notify_timer.disconnect();
+        scene_index.sync(wf::get_core().scene());
+        if (scene_index.generation != scene_sent_generation)
+        {
+            notify_scene_subscribers();
+        }
+
+        // Nodes marked dirty while sending do not call on_dirty again
+        if (scene_index.has_dirty())
+        {
+            schedule_scene_changes();
+        }
+    }
+
+    void notify_scene_subscribers()
+    {
+        wf::json_t changed = wf::json_t::array();
+        dump_changes(*scene_index.find(wf::get_core().scene().get()), scene_sent_generation, -1, changed);
+
+        std::vector<uint64_t> removed_ids;
+        bool complete = scene_index.get_removed(scene_sent_generation, removed_ids);
+        wf::json_t removed = wf::json_t::array();
+        for (auto id : removed_ids)
+        {
+            removed.append(id);
+        }
+
+        wf::json_t event;
+        event["event"]      = "ammen99/debug/scene-changes";
+        event["since"]      = scene_sent_generation;
+        event["generation"] = scene_index.generation;
+        event["changed"]    = changed;
+        event["removed"]    = removed;
+        event["complete"]   = complete;
+        scene_sent_generation = scene_index.generation;
+        streams->send_event(scene_subscribers, event);
+    }
+
+    void remove_scene_subscriber(wf::ipc::client_interface_t *client)
+    {
+        scene_subscribers.erase(client);
+        if (scene_subscribers.empty())
+        {
+            scene_notify_timer.disconnect();
+            release_scene_index();
+        }
+    }
+
+    /**
+     * Stop watching the scene when there are no subscribers and no streams.
+     * The index is kept, so that ids and generations stay valid.
+     */
+    void release_scene_index()
+    {
+        if (scene_subscribers.empty() && scene_streams.empty())
+        {
+            scene_index.unwatch();
+        }
+    }
+
+    /**
+     * Subscribe to scene change events, or unsubscribe with "enabled": false.
+     * The reply contains the current generation, so that the client can fetch
+     * the scene with scenedump and then apply the events after it.
+     */
+    wf::ipc::method_callback_full method_scene_subscribe = [=] (const wf::json_t& data,
+                                                               wf::ipc::client_interface_t *client)
+    {
+        if (!client)
+        {
+            return wf::ipc::json_error("scene_subscribe can only be used by IPC clients");
+        }
+
+        if (!wf::ipc::json_get_optional_bool(data, "enabled").value_or(true))
+        {
+            remove_scene_subscriber(client);
+            return wf::ipc::json_ok();
+        }
+
+        // Changes before the subscription are not sent as events
+        send_scene_changes();
+        scene_subscribers.insert(client);
+        if (scene_index.has_dirty())
+        {
+            schedule_scene_changes();
+        }
+
+        auto response = wf::ipc::json_ok();
+        response["generation"] = scene_index.generation;
+        return response;
     };
 };
 
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace wf
+{
+namespace json_stream
+{
+/**
+ * Serializes JSON directly into a string buffer, without building a tree.
+ *
+ * The caller owns the buffer and may take its contents at any point, e.g. to
+ * send a large document in chunks; the writer only appends to it.
+ */
+class json_writer_t
+{
+  public:
+    json_writer_t(std::string& out) : out(out)
+    {}
+
+    void begin_object()
+    {
+        separator();
+        out += '{';
+        first.push_back(true);
+    }
+
+    void end_object()
+    {
+        out += '}';
+        first.pop_back();
+    }
+
+    void begin_array()
+    {
+        separator();
+        out += '[';
+        first.push_back(true);
+    }
+
+    void end_array()
+    {
+        out += ']';
+        first.pop_back();
+    }
+
+    void key(std::string_view name)
+    {
+        separator();
+        write_string(name);
+        out += ':';
+        after_key = true;
+    }
+
+    void value(std::string_view str)
+    {
+        separator();
+        write_string(str);
+    }
+
+    void value(const char *str)
+    {
+        value(std::string_view{str});
+    }
+
+    void value(bool b)
+    {
+        separator();
+        out += b ? "true" : "false";
+    }
+
+    void value(double d)
+    {
+        separator();
+        if (!std::isfinite(d))
+        {
+            out += "null";
+            return;
+        }
+
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.17g", d);
+        out += buf;
+    }
+
+    template<class T>
+    std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>> value(T i)
+    {
+        separator();
+        out += std::to_string(i);
+    }
+
+    void null()
+    {
+        separator();
+        out += "null";
+    }
+
+    /** Write `"name": value`. */
+    template<class T>
+    void member(std::string_view name, const T& v)
+    {
+        key(name);
+        value(v);
+    }
+
+  private:
+    void separator()
+    {
+        if (after_key)
+        {
+            after_key = false;
+            return;
+        }
+
+        if (!first.empty())
+        {
+            if (!first.back())
+            {
+                out += ',';
+            }
+
+            first.back() = false;
+        }
+    }
+
+    void write_string(std::string_view str)
+    {
+        out += '"';
+        for (char c : str)
+        {
+            switch (c)
+            {
+              case '"':
+                out += "\\\"";
+                break;
+
+              case '\\':
+                out += "\\\\";
+                break;
+
+              case '\n':
+                out += "\\n";
+                break;
+
+              case '\t':
+                out += "\\t";
+                break;
+
+              default:
+                if ((unsigned char)c < 0x20)
+                {
+                    char buf[8];
+                    snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                } else
+                {
+                    out += c;
+                }
+            }
+        }
+
+        out += '"';
+    }
+
+    std::string& out;
+    // For each open object or array, whether nothing has been written to it yet
+    std::vector<bool> first;
+    bool after_key = false;
+};
+}
+}
@@ -0,0 +1,302 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace wf
+{
+namespace log_filter
+{
+/**
+ * The parts of a log line formatted by wf::log without colors:
+ *
+ * "DD 17-10-25 12:00:00.000 - [src/core/core.cpp:123] [CATEGORY] message"
+ *
+ * The category is only present for LOGC() messages.
+ */
+struct log_line_t
+{
+    char level = 0;
+    std::string_view file;
+    std::string_view category;
+    std::string_view message;
+};
+
+inline log_line_t parse_line(std::string_view line)
+{
+    log_line_t result;
+    if (line.empty())
+    {
+        return result;
+    }
+
+    result.level = line[0];
+    auto source_start = line.find(" - [");
+    auto source_end   = line.find("] ", source_start);
+    if ((source_start == line.npos) || (source_end == line.npos))
+    {
+        result.message = line;
+        return result;
+    }
+
+    auto source = line.substr(source_start + 4, source_end - source_start - 4);
+    result.file    = source.substr(0, source.rfind(':'));
+    result.message = line.substr(source_end + 2);
+    if ((result.message.size() > 1) && (result.message[0] == '['))
+    {
+        auto category_end = result.message.find("] ");
+        if (category_end != result.message.npos)
+        {
+            result.category = result.message.substr(1, category_end - 1);
+            result.message  = result.message.substr(category_end + 2);
+        }
+    }
+
+    return result;
+}
+
+/** The severity of a level character, higher is more severe. */
+inline int level_severity(char level)
+{
+    switch (level)
+    {
+      case 'D':
+        return 0;
+
+      case 'I':
+        return 1;
+
+      case 'W':
+        return 2;
+
+      case 'E':
+        return 3;
+
+      default:
+        return 0;
+    }
+}
+
+/**
+ * A log filter which avoids running a regex on most lines.
+ *
+ * The line must have at least the given level, come from a source file
+ * containing @file and have the category @category, and the whole line must
+ * match the regex @pattern (like std::regex_match).
+ *
+ * Literals which every match of the pattern must contain are extracted when
+ * compiling, and lines which do not contain them are rejected with a substring
+ * search. Patterns of the form ".*literal.*" are matched without a regex.
+ */
+class filter_t
+{
+  public:
+    /** Compile the filter. Returns an error message if the pattern is invalid. */
+    std::string compile(const std::string& pattern, char min_level = 'D',
+        const std::string& file = "", const std::string& category = "")
+    {
+        this->min_severity = level_severity(min_level);
+        this->file     = file;
+        this->category = category;
+        this->needs_predicates = (min_severity > 0) || !file.empty() || !category.empty();
+
+        try {
+            regex = std::regex(pattern, std::regex::ECMAScript | std::regex::optimize);
+        } catch (const std::regex_error& e)
+        {
+            return std::string("invalid regex: ") + e.what();
+        }
+
+        needs_regex = !extract_literals(pattern);
+        return "";
+    }
+
+    bool match(std::string_view line) const
+    {
+        if (needs_predicates && !match_predicates(parse_line(line)))
+        {
+            return false;
+        }
+
+        for (auto& literal : literals)
+        {
+            if (line.find(literal) == line.npos)
+            {
+                return false;
+            }
+        }
+
+        return !needs_regex || std::regex_match(line.begin(), line.end(), regex);
+    }
+
+    /** Whether a regex still has to run on lines which pass the prefilter. */
+    bool uses_regex() const
+    {
+        return needs_regex;
+    }
+
+    const std::vector<std::string>& required_literals() const
+    {
+        return literals;
+    }
+
+  private:
+    bool match_predicates(const log_line_t& line) const
+    {
+        return (level_severity(line.level) >= min_severity) &&
+               (file.empty() || (line.file.find(file) != line.file.npos)) &&
+               (category.empty() || (line.category == category));
+    }
+
+    /**
+     * Collect the literal runs which any full match of @pattern must contain.
+     * The extraction is conservative: literals inside groups, character classes
+     * or optional atoms are skipped, and nothing is extracted from patterns
+     * with a top-level alternation.
+     *
+     * @return Whether the pattern is exactly ".*literal.*" (or ".*"), in which
+     *   case the literal check alone decides the match.
+     */
+    bool extract_literals(const std::string& pattern)
+    {
+        literals.clear();
+
+        std::string run;
+        bool simple = true;
+        int depth   = 0;
+        auto end_run = [&] ()
+        {
+            if (!run.empty())
+            {
+                literals.push_back(run);
+                run.clear();
+            }
+        };
+
+        for (size_t i = 0; i < pattern.size(); i++)
+        {
+            char c = pattern[i];
+            bool quantifier = (c == '*') || (c == '?') || (c == '{') || (c == '+');
+            if (quantifier)
+            {
+                // Allow ".*" at the start and at the end of simple patterns
+                bool leading_wildcard = (c == '*') && (i == 1) && (pattern[0] == '.');
+                bool trailing_wildcard = (c == '*') && (i == pattern.size() - 1) && (i >= 2) &&
+                    (pattern[i - 1] == '.') && (pattern[i - 2] != '\\');
+                simple &= leading_wildcard || trailing_wildcard;
+
+                if ((c != '+') && (depth == 0) && !run.empty())
+                {
+                    // The previous character is optional
+                    run.pop_back();
+                }
+
+                end_run();
+                if (c == '{')
+                {
+                    i = std::min(pattern.find('}', i), pattern.size());
+                }
+
+                continue;
+            }
+
+            if (c == '\\' && (i + 1 < pattern.size()))
+            {
+                char next = pattern[++i];
+                if (isalnum((unsigned char)next))
+                {
+                    // \d, \w, \b, back-references and the like. Skip the rest of
+                    // escapes with arguments too, those are not literals
+                    simple = false;
+                    end_run();
+                    size_t arguments = (next == 'x') ? 2 : (next == 'u') ? 4 : (next == 'c') ? 1 : 0;
+                    if (isdigit((unsigned char)next))
+                    {
+                        arguments = std::find_if_not(pattern.begin() + i + 1, pattern.end(),
+                            [] (unsigned char d) { return isdigit(d); }) - pattern.begin() - i - 1;
+                    }
+
+                    i = std::min(i + arguments, pattern.size() - 1);
+                } else if (depth == 0)
+                {
+                    run += next;
+                }
+
+                continue;
+            }
+
+            switch (c)
+            {
+              case '|':
+                if (depth == 0)
+                {
+                    literals.clear();
+                    return false;
+                }
+
+                break;
+
+              case '(':
+                ++depth;
+                simple = false;
+                end_run();
+                break;
+
+              case ')':
+                depth = std::max(0, depth - 1);
+                end_run();
+                break;
+
+              case '[':
+                // Skip the class, a ']' right after '[' or '[^' is literal
+                i += (i + 1 < pattern.size() && pattern[i + 1] == '^') ? 2 : 1;
+                i += (i < pattern.size() && pattern[i] == ']') ? 1 : 0;
+                while (i < pattern.size() && pattern[i] != ']')
+                {
+                    i += (pattern[i] == '\\') ? 2 : 1;
+                }
+
+                simple = false;
+                end_run();
+                break;
+
+              case '.':
+              case '^':
+              case '$':
+                // A '.' is only allowed as part of the leading or trailing ".*"
+                simple &= (c == '.') && (i + 1 < pattern.size()) && (pattern[i + 1] == '*') &&
+                    ((i == 0) || (i + 2 == pattern.size()));
+                end_run();
+                break;
+
+              default:
+                if (depth == 0)
+                {
+                    run += c;
+                }
+            }
+        }
+
+        end_run();
+
+        // Without the wildcards on both ends, the match would be anchored
+        bool wildcards = (pattern.size() >= 2) && (pattern.compare(0, 2, ".*") == 0) &&
+            (pattern.compare(pattern.size() - 2, 2, ".*") == 0);
+        return simple && wildcards && (literals.size() <= 1);
+    }
+
+    std::regex regex;
+    bool needs_regex = true;
+    std::vector<std::string> literals;
+
+    bool needs_predicates = false;
+    int min_severity = 0;
+    std::string file;
+    std::string category;
+};
+}
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include <string_view>
+#include "mapped-file.hpp"
+
+namespace wf
+{
+namespace log_ring
+{
+/**
+ * The layout of a log ring file: file_header_t, then `capacity` bytes of text.
+ *
+ * Lines are written one after another, each terminated by '\n', and wrap
+ * around at the end of the data. `written` is the total number of bytes
+ * written so far, so byte N is stored at offset N % capacity. Once the ring has
+ * wrapped, readers start after the first '\n' following the oldest byte.
+ */
+static constexpr char MAGIC[8] = {'W', 'F', 'L', 'O', 'G', 'R', 'N', 'G'};
+
+struct file_header_t
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t capacity;
+    std::atomic<uint64_t> written;
+    uint8_t padding[32];
+};
+
+static_assert(sizeof(file_header_t) == 64, "Log ring header must be 64 bytes");
+
+/**
+ * Writes log lines into a memory-mapped ring file. Writing a line is a copy
+ * into the mapping, without syscalls; the kernel writes the pages back.
+ */
+class ring_file_t
+{
+  public:
+    static constexpr uint64_t MAX_CAPACITY = 1ull << 30;
+
+    ~ring_file_t()
+    {
+        close();
+    }
+
+    /**
+     * Start writing to the file at @path, keeping the last @capacity bytes.
+     * Returns an empty string on success, or an error message.
+     */
+    std::string open(const std::string& path, uint64_t capacity)
+    {
+        close();
+        if ((capacity == 0) || (capacity > MAX_CAPACITY))
+        {
+            return "ring size must be between 1 and " + std::to_string(MAX_CAPACITY);
+        }
+
+        auto error = file.map(path, sizeof(file_header_t) + capacity);
+        if (!error.empty())
+        {
+            return error;
+        }
+
+        header = new (file.get()) file_header_t{};
+        memcpy(header->magic, MAGIC, sizeof(MAGIC));
+        header->version  = 1;
+        header->capacity = capacity;
+        header->written.store(0, std::memory_order_relaxed);
+        data = file.get() + sizeof(file_header_t);
+        return "";
+    }
+
+    void close()
+    {
+        file.unmap();
+        header = nullptr;
+        data   = nullptr;
+    }
+
+    bool active() const
+    {
+        return header != nullptr;
+    }
+
+    void write_line(std::string_view line)
+    {
+        if (!header)
+        {
+            return;
+        }
+
+        uint64_t pos = header->written.load(std::memory_order_relaxed);
+        copy(pos, line.data(), line.size());
+        copy(pos + line.size(), "\n", 1);
+        header->written.store(pos + line.size() + 1, std::memory_order_release);
+    }
+
+  private:
+    void copy(uint64_t pos, const char *src, uint64_t len)
+    {
+        // Only the last `capacity` bytes of very long lines survive
+        uint64_t capacity = header->capacity;
+        if (len > capacity)
+        {
+            pos += len - capacity;
+            src += len - capacity;
+            len  = capacity;
+        }
+
+        uint64_t offset = pos % capacity;
+        uint64_t first  = std::min(len, capacity - offset);
+        memcpy(data + offset, src, first);
+        memcpy(data, src + first, len - first);
+    }
+
+    wf::mapped_file_t file;
+    file_header_t *header = nullptr;
+    char *data = nullptr;
+};
+}
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "output-file.hpp"
+
+namespace wf
+{
+/**
+ * A file mapped into memory with MAP_SHARED, used for the ring files of the
+ * tracer and of the log. Writers just copy into the mapping, the kernel
+ * writes the pages back to the file.
+ */
+class mapped_file_t
+{
+  public:
+    ~mapped_file_t()
+    {
+        unmap();
+    }
+
+    /**
+     * Create (or truncate) the file at @path with @size bytes and map it. The
+     * path comes from an IPC client, see open_output_file() for the files
+     * which are accepted. Returns an empty string on success, or an error message.
+     */
+    std::string map(const std::string& path, size_t size)
+    {
+        unmap();
+        int fd;
+        auto error = open_output_file(path, fd);
+        if (!error.empty())
+        {
+            return error;
+        }
+
+        if (ftruncate(fd, size) < 0)
+        {
+            error = "failed to resize " + path + ": " + strerror(errno);
+            close(fd);
+            return error;
+        }
+
+        void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mem == MAP_FAILED)
+        {
+            return "failed to map " + path + ": " + strerror(errno);
+        }
+
+        data = (char*)mem;
+        map_size = size;
+        return "";
+    }
+
+    /** Unmap the file. The file keeps what was written so far. */
+    void unmap()
+    {
+        if (data)
+        {
+            munmap(data, map_size);
+            data = nullptr;
+        }
+    }
+
+    char *get() const
+    {
+        return data;
+    }
+
+  private:
+    char *data = nullptr;
+    size_t map_size = 0;
+};
+}
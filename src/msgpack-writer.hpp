@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace wf
+{
+namespace msgpack
+{
+/**
+ * Serializes MessagePack directly into a string buffer.
+ *
+ * Unlike JSON, maps and arrays start with their element count, so the caller
+ * has to know it up front. A map of N entries is followed by N key/value pairs.
+ */
+class writer_t
+{
+  public:
+    writer_t(std::string& out) : out(out)
+    {}
+
+    void begin_map(uint32_t entries)
+    {
+        header(entries, 0x80, 16, 0xde);
+    }
+
+    void begin_array(uint32_t elements)
+    {
+        header(elements, 0x90, 16, 0xdc);
+    }
+
+    void value(std::string_view str)
+    {
+        header(str.size(), 0xa0, 32, 0xda, 0xd9);
+        out.append(str.data(), str.size());
+    }
+
+    void value(const char *str)
+    {
+        value(std::string_view{str});
+    }
+
+    void value(bool b)
+    {
+        out += (char)(b ? 0xc3 : 0xc2);
+    }
+
+    void value(double d)
+    {
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        out += (char)0xcb;
+        big_endian(bits, 8);
+    }
+
+    template<class T>
+    std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>> value(T i)
+    {
+        if constexpr (std::is_signed_v<T>)
+        {
+            if (i < 0)
+            {
+                write_negative(i);
+                return;
+            }
+        }
+
+        write_unsigned(i);
+    }
+
+    void null()
+    {
+        out += (char)0xc0;
+    }
+
+  private:
+    /**
+     * Write the header of a map, array or string of @size elements: the fixed
+     * form @fixed | size if size < @fixed_limit, else an optional 8-bit form
+     * (only for strings), else the 16-bit form @code16 followed by the 32-bit
+     * form @code16 + 1.
+     */
+    void header(uint64_t size, uint8_t fixed, uint64_t fixed_limit, uint8_t code16, uint8_t code8 = 0)
+    {
+        if (size < fixed_limit)
+        {
+            out += (char)(fixed | size);
+        } else if (code8 && (size <= UINT8_MAX))
+        {
+            out += (char)code8;
+            big_endian(size, 1);
+        } else if (size <= UINT16_MAX)
+        {
+            out += (char)code16;
+            big_endian(size, 2);
+        } else
+        {
+            out += (char)(code16 + 1);
+            big_endian(size, 4);
+        }
+    }
+
+    void write_unsigned(uint64_t i)
+    {
+        if (i < 0x80)
+        {
+            out += (char)i;
+        } else if (i <= UINT8_MAX)
+        {
+            out += (char)0xcc;
+            big_endian(i, 1);
+        } else if (i <= UINT16_MAX)
+        {
+            out += (char)0xcd;
+            big_endian(i, 2);
+        } else if (i <= UINT32_MAX)
+        {
+            out += (char)0xce;
+            big_endian(i, 4);
+        } else
+        {
+            out += (char)0xcf;
+            big_endian(i, 8);
+        }
+    }
+
+    void write_negative(int64_t i)
+    {
+        if (i >= -32)
+        {
+            out += (char)i;
+        } else if (i >= INT8_MIN)
+        {
+            out += (char)0xd0;
+            big_endian(i, 1);
+        } else if (i >= INT16_MIN)
+        {
+            out += (char)0xd1;
+            big_endian(i, 2);
+        } else if (i >= INT32_MIN)
+        {
+            out += (char)0xd2;
+            big_endian(i, 4);
+        } else
+        {
+            out += (char)0xd3;
+            big_endian(i, 8);
+        }
+    }
+
+    void big_endian(uint64_t v, int bytes)
+    {
+        for (int i = bytes - 1; i >= 0; i--)
+        {
+            out += (char)((v >> (8 * i)) & 0xff);
+        }
+    }
+
+    std::string& out;
+};
+}
+}
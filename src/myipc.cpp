@@ -1,5 +1,16 @@
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <wayfire/config/option.hpp>
 #include <wayfire/core.hpp>
 #include <wayfire/geometry.hpp>
+#include <wayfire/matcher.hpp>
+#include <wayfire/output.hpp>
+#include <wayfire/output-layout.hpp>
+#include <wayfire/toplevel-view.hpp>
 #include <wayfire/plugin.hpp>
 #include <wayfire/plugins/ipc/ipc-method-repository.hpp>
 #include <wayfire/plugins/ipc/ipc-helpers.hpp>
@@ -8,16 +19,385 @@
 #include <wayfire/util/log.hpp>
 #include <wayfire/debug.hpp>
 #include <wayfire/seat.hpp>
+#include "binary-stream.hpp"
+#include "trace.hpp"
 
 class ammen99_ipc_commands : public wf::plugin_interface_t
 {
     wf::shared_data::ref_ptr_t<wf::ipc::method_repository_t> repository;
+    wf::shared_data::ref_ptr_t<wf::trace::recorder_t> tracer;
+    wf::shared_data::ref_ptr_t<wf::binary_stream::streams_t> streams;
+
   public:
     void init() override
     {
-        repository->register_method("ammen99/ipc/set_grid_size", method_set_grid_size);
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/ipc/set_grid_size", method_set_grid_size);
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/ipc/batch", method_batch);
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/ipc/query", method_query);
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/ipc/binary_stream", method_binary_stream);
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "ammen99/ipc/encoding_bench", method_encoding_bench);
+    }
+
+    void fini() override
+    {
+        repository->unregister_method("ammen99/ipc/set_grid_size");
+        repository->unregister_method("ammen99/ipc/batch");
+        repository->unregister_method("ammen99/ipc/query");
+        repository->unregister_method("ammen99/ipc/binary_stream");
+        repository->unregister_method("ammen99/ipc/encoding_bench");
+    }
+
+    /**
+     * Run the calls in "calls", each an object with "method" and "data" like a
+     * message on the IPC socket, and return their results in "results" in the
+     * same order. All calls run in the same main loop iteration, so no frame is
+     * rendered with only some of them applied. A call which throws, e.g. on
+     * invalid arguments, returns an error at its index like any other failed
+     * call. With "stop_on_error", the calls after the first error are skipped.
+     */
+    wf::ipc::method_callback_full method_batch = [=] (const wf::json_t& data,
+                                                      wf::ipc::client_interface_t *client)
+    {
+        if (!data.has_member("calls") || !data["calls"].is_array())
+        {
+            return wf::ipc::json_error("missing or wrong json type for `calls`");
+        }
+
+        bool stop_on_error = wf::ipc::json_get_optional_bool(data, "stop_on_error").value_or(false);
+        const auto& calls  = data["calls"];
+        wf::json_t results = wf::json_t::array();
+        for (size_t i = 0; i < calls.size(); i++)
+        {
+            // Same requirements as for messages from the IPC socket
+            if (!calls[i].is_object() || !calls[i].has_member("method") ||
+                !calls[i]["method"].is_string() || !calls[i].has_member("data"))
+            {
+                return wf::ipc::json_error("call " + std::to_string(i) + " is missing method or data");
+            }
+
+            std::string method = calls[i]["method"].as_string();
+            if (method == "ammen99/ipc/batch")
+            {
+                return wf::ipc::json_error("batches cannot be nested");
+            }
+        }
+
+        size_t executed = 0;
+        for (size_t i = 0; i < calls.size(); i++)
+        {
+            wf::json_t result;
+            try
+            {
+                result = repository->call_method(calls[i]["method"].as_string(), calls[i]["data"], client);
+            } catch (const std::exception& e)
+            {
+                // E.g. a json_get_* helper rejected the arguments of the call
+                result = wf::ipc::json_error(e.what());
+            }
+
+            ++executed;
+
+            bool failed = result.is_object() && result.has_member("error");
+            results.append(result);
+            if (failed && stop_on_error)
+            {
+                break;
+            }
+        }
+
+        auto response = wf::ipc::json_ok();
+        response["results"]  = results;
+        response["executed"] = (uint64_t)executed;
+        return response;
+    };
+
+    /**
+     * Fields which can be requested with ammen99/ipc/query. With @compact,
+     * geometries are [x, y, width, height] arrays instead of objects.
+     */
+    template<class T>
+    using field_getter_t = std::function<wf::json_t(T, bool compact)>;
+
+    static wf::json_t geometry_to_json(wf::geometry_t g, bool compact)
+    {
+        if (!compact)
+        {
+            return wf::ipc::geometry_to_json(g);
+        }
+
+        wf::json_t result = wf::json_t::array();
+        result.append(g.x);
+        result.append(g.y);
+        result.append(g.width);
+        result.append(g.height);
+        return result;
+    }
+
+    static wf::json_t point_to_json(wf::point_t p, bool compact)
+    {
+        return geometry_to_json({p.x, p.y, 0, 0}, compact);
+    }
+
+    const std::map<std::string, field_getter_t<wayfire_view>> view_fields = {
+        {"id", [] (wayfire_view view, bool) { return wf::json_t((uint64_t)view->get_id()); }},
+        {"app_id", [] (wayfire_view view, bool) { return wf::json_t(view->get_app_id()); }},
+        {"title", [] (wayfire_view view, bool) { return wf::json_t(view->get_title()); }},
+        {"geometry", [] (wayfire_view view, bool compact)
+            {
+                auto toplevel = wf::toplevel_cast(view);
+                return geometry_to_json(toplevel ? toplevel->get_geometry() : view->get_bounding_box(), compact);
+            }
+        },
+        {"output", [] (wayfire_view view, bool)
+            {
+                return wf::json_t(view->get_output() ? (int64_t)view->get_output()->get_id() : (int64_t)-1);
+            }
+        },
+        {"workspace", [] (wayfire_view view, bool compact)
+            {
+                auto toplevel = wf::toplevel_cast(view);
+                if (!toplevel || !toplevel->get_wset())
+                {
+                    return wf::json_t{};
+                }
+
+                return point_to_json(toplevel->get_wset()->get_view_main_workspace(toplevel), compact);
+            }
+        },
+        {"focus", [] (wayfire_view view, bool)
+            {
+                return wf::json_t(wf::get_core().seat->get_active_view() == view);
+            }
+        },
+    };
+
+    const std::map<std::string, field_getter_t<wf::output_t*>> output_fields = {
+        {"id", [] (wf::output_t *output, bool) { return wf::json_t((int64_t)output->get_id()); }},
+        {"name", [] (wf::output_t *output, bool) { return wf::json_t(output->to_string()); }},
+        {"geometry", [] (wf::output_t *output, bool compact)
+            {
+                return geometry_to_json(output->get_layout_geometry(), compact);
+            }
+        },
+        {"workspace", [] (wf::output_t *output, bool compact)
+            {
+                return point_to_json(output->wset()->get_current_workspace(), compact);
+            }
+        },
+        {"focus", [] (wf::output_t *output, bool)
+            {
+                return wf::json_t(wf::get_core().seat->get_active_output() == output);
+            }
+        },
+    };
+
+    /**
+     * Serialize @objects with only the fields named in data["fields"], or all
+     * fields if there is no such list. The result is a list of objects, or with
+     * data["columnar"], an object with the field names in "fields" and one list
+     * of values per field in "columns".
+     */
+    template<class T>
+    wf::json_t project_fields(const std::vector<T>& objects, const wf::json_t& data,
+        const std::map<std::string, field_getter_t<T>>& fields)
+    {
+        std::vector<std::pair<std::string, const field_getter_t<T>*>> selected;
+        if (data.has_member("fields"))
+        {
+            if (!data["fields"].is_array())
+            {
+                return wf::ipc::json_error("wrong json type for `fields`");
+            }
+
+            for (size_t i = 0; i < data["fields"].size(); i++)
+            {
+                std::string name = data["fields"][i].is_string() ? data["fields"][i].as_string() : "";
+                auto it = fields.find(name);
+                if (it == fields.end())
+                {
+                    return wf::ipc::json_error("unknown field: " + name);
+                }
+
+                selected.emplace_back(it->first, &it->second);
+            }
+        } else
+        {
+            for (auto& [name, getter] : fields)
+            {
+                selected.emplace_back(name, &getter);
+            }
+        }
+
+        auto response = wf::ipc::json_ok();
+        if (wf::ipc::json_get_optional_bool(data, "columnar").value_or(false))
+        {
+            wf::json_t names   = wf::json_t::array();
+            wf::json_t columns = wf::json_t::array();
+            for (auto& [name, getter] : selected)
+            {
+                wf::json_t column = wf::json_t::array();
+                for (auto& object : objects)
+                {
+                    column.append((*getter)(object, true));
+                }
+
+                names.append(name);
+                columns.append(column);
+            }
+
+            response["count"]   = (uint64_t)objects.size();
+            response["fields"]  = names;
+            response["columns"] = columns;
+            return response;
+        }
+
+        wf::json_t rows = wf::json_t::array();
+        for (auto& object : objects)
+        {
+            wf::json_t row;
+            for (auto& [name, getter] : selected)
+            {
+                row[name] = (*getter)(object, false);
+            }
+
+            rows.append(row);
+        }
+
+        response["items"] = rows;
+        return response;
     }
 
+    // The matcher of the last query, pollers usually repeat the same one
+    std::string last_match;
+    std::unique_ptr<wf::view_matcher_t> last_matcher;
+
+    /**
+     * Query the state of all "views" (the default) or "outputs", see
+     * project_fields() for the format. Views can be filtered with a view
+     * matcher expression in "match", e.g. `app_id is "foot"`.
+     */
+    wf::ipc::method_callback method_query = [=] (const wf::json_t& data)
+    {
+        auto type = wf::ipc::json_get_optional_string(data, "type").value_or("views");
+        if (type == "outputs")
+        {
+            return project_fields(wf::get_core().output_layout->get_outputs(), data, output_fields);
+        }
+
+        if (type != "views")
+        {
+            return wf::ipc::json_error("unknown type: " + type);
+        }
+
+        auto match = wf::ipc::json_get_optional_string(data, "match");
+        if (match && (!last_matcher || (*match != last_match)))
+        {
+            last_match   = *match;
+            last_matcher = std::make_unique<wf::view_matcher_t>(
+                std::make_shared<wf::config::option_t<std::string>>("ammen99-ipc/query", *match));
+        }
+
+        std::vector<wayfire_view> views;
+        for (auto& view : wf::get_core().get_all_views())
+        {
+            if (view->is_mapped() && (!match || last_matcher->matches(view)))
+            {
+                views.push_back(view);
+            }
+        }
+
+        return project_fields(views, data, view_fields);
+    };
+
+    /**
+     * Open a binary side channel for the events sent to this client, or close
+     * it with "enabled": false. See wf::binary_stream::streams_t for the
+     * handshake with the returned "path" and "token".
+     */
+    wf::ipc::method_callback_full method_binary_stream = [=] (const wf::json_t& data,
+                                                              wf::ipc::client_interface_t *client)
+    {
+        if (!client)
+        {
+            return wf::ipc::json_error("binary_stream can only be used by IPC clients");
+        }
+
+        if (!wf::ipc::json_get_optional_bool(data, "enabled").value_or(true))
+        {
+            streams->close(client);
+            return wf::ipc::json_ok();
+        }
+
+        std::string path, token;
+        auto error = streams->open(client, path, token);
+        if (!error.empty())
+        {
+            return wf::ipc::json_error(error);
+        }
+
+        auto response = wf::ipc::json_ok();
+        response["path"]     = path;
+        response["token"]    = token;
+        response["encoding"] = "msgpack";
+        return response;
+    };
+
+    /**
+     * Measure how long it takes to encode "payload" as a JSON message and as a
+     * MessagePack frame of the binary side channel, "iterations" times each.
+     * If the client has a side channel, the payload is also sent on it as an
+     * "ammen99/ipc/encoding-bench" event, so that the client can measure decoding.
+     */
+    wf::ipc::method_callback_full method_encoding_bench = [=] (const wf::json_t& data,
+                                                               wf::ipc::client_interface_t *client)
+    {
+        if (!data.has_member("payload"))
+        {
+            return wf::ipc::json_error("missing `payload`");
+        }
+
+        const wf::json_t& payload = data["payload"];
+        int64_t iterations = std::clamp<int64_t>(
+            wf::ipc::json_get_optional_int64(data, "iterations").value_or(1000), 1, 1'000'000);
+
+        auto measure = [&] (auto encode)
+        {
+            size_t size = 0;
+            auto start  = std::chrono::steady_clock::now();
+            for (int64_t i = 0; i < iterations; i++)
+            {
+                size = encode().size();
+            }
+
+            std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+            wf::json_t result;
+            result["bytes"] = (uint64_t)size;
+            result["us-per-message"] = elapsed.count() / iterations;
+            result["mb-per-second"]  = size * iterations / std::max(elapsed.count(), 1e-3);
+            return result;
+        };
+
+        auto response = wf::ipc::json_ok();
+        response["iterations"] = iterations;
+        response["json"] = measure([&] () { return payload.serialize(); });
+        response["msgpack"] = measure([&] () { return wf::binary_stream::encode_frame(payload); });
+
+        if (client)
+        {
+            wf::json_t event;
+            event["event"]   = "ammen99/ipc/encoding-bench";
+            event["payload"] = payload;
+            streams->send_event(client, event);
+        }
+
+        return response;
+    };
+
     wf::ipc::method_callback method_set_grid_size = [=] (const wf::json_t& data)
     {
         int width = wf::ipc::json_get_uint64(data, "width");
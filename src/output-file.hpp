@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace wf
+{
+/**
+ * Check a path which an IPC client asked the compositor to read or write. It
+ * has to be absolute, so that it does not depend on the compositor's working
+ * directory. Returns an empty string if the path is valid, or an error message.
+ */
+inline std::string check_client_path(const std::string& path)
+{
+    if (path.empty() || (path[0] != '/'))
+    {
+        return "path must be absolute: " + path;
+    }
+
+    return "";
+}
+
+/**
+ * Open the file at the client-supplied @path for writing, creating it if it
+ * does not exist, and truncate it. Only regular files are truncated: symlinks,
+ * devices, fifos and sockets are refused.
+ *
+ * Returns an empty string and sets @fd on success, or returns an error message.
+ */
+inline std::string open_output_file(const std::string& path, int& fd)
+{
+    auto error = check_client_path(path);
+    if (!error.empty())
+    {
+        return error;
+    }
+
+    // O_NONBLOCK keeps the open of a fifo from blocking, it is refused below
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return "failed to open " + path + ": " + strerror(errno);
+    }
+
+    struct stat st;
+    if ((fstat(fd, &st) < 0) || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return "not a regular file: " + path;
+    }
+
+    if (ftruncate(fd, 0) < 0)
+    {
+        error = "failed to truncate " + path + ": " + strerror(errno);
+        close(fd);
+        return error;
+    }
+
+    return "";
+}
+
+/**
+ * Replace the contents of the file at the client-supplied @path with
+ * @contents, see open_output_file(). Returns an empty string on success, or an
+ * error message.
+ */
+inline std::string write_output_file(const std::string& path, const std::string& contents)
+{
+    int fd;
+    auto error = open_output_file(path, fd);
+    if (!error.empty())
+    {
+        return error;
+    }
+
+    size_t done = 0;
+    while (done < contents.size())
+    {
+        ssize_t n = write(fd, contents.data() + done, contents.size() - done);
+        if ((n < 0) && (errno != EINTR))
+        {
+            error = "failed to write " + path + ": " + strerror(errno);
+            break;
+        }
+
+        done += std::max<ssize_t>(n, 0);
+    }
+
+    close(fd);
+    return error;
+}
+}
@@ -1,7 +1,11 @@
+#include <utility>
 #include <wayfire/core.hpp>
 #include <wayfire/geometry.hpp>
 #include <wayfire/opengl.hpp>
 #include <wayfire/option-wrapper.hpp>
+#include <wayfire/output.hpp>
+#include <wayfire/output-layout.hpp>
+#include <wayfire/per-output-plugin.hpp>
 #include <wayfire/plugin.hpp>
 #include <wayfire/region.hpp>
 #include <wayfire/bindings-repository.hpp>
@@ -10,6 +14,128 @@
 #include <wayfire/signal-definitions.hpp>
 #include <wayfire/signal-provider.hpp>
 #include <wayfire/nonstd/wlroots-full.hpp>
+#include <wayfire/plugins/common/shared-core-data.hpp>
+#include <wayfire/plugins/ipc/ipc-method-repository.hpp>
+#include <wayfire/plugins/ipc/ipc-helpers.hpp>
+#include "bench-stats.hpp"
+#include "trace.hpp"
+
+/** Latency statistics shared between all outputs, in microseconds. */
+struct input_latency_stats_t
+{
+    wf::bench::frame_histogram_t histogram;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+
+    void add(uint64_t latency)
+    {
+        histogram.add(latency);
+        sum += latency;
+        max  = std::max(max, latency);
+    }
+
+    void reset()
+    {
+        histogram.clear();
+        sum = max = 0;
+    }
+};
+
+/**
+ * Tracks input events which caused damage on an output until the frame
+ * containing that damage is presented.
+ */
+class input_latency_probe_t : public wf::per_output_plugin_instance_t
+{
+    static constexpr size_t MAX_PENDING = 256;
+
+    struct inflight_t
+    {
+        uint32_t seq;
+        uint64_t input_time;
+    };
+
+    // Input events whose damage has not been committed yet
+    wf::bench::ring_buffer_t<uint64_t> queued{MAX_PENDING};
+    // Input events whose damage was committed, but not presented yet
+    wf::bench::ring_buffer_t<inflight_t> inflight{MAX_PENDING};
+
+    wf::wl_listener_wrapper on_precommit, on_present;
+
+  public:
+    input_latency_stats_t *stats = nullptr;
+
+    void init() override
+    {
+        on_precommit.set_callback([=] (void *data)
+        {
+            // Commits without a buffer (e.g. mode or DPMS changes) are never
+            // presented as a frame, the inputs wait for the next frame instead
+            auto ev = (wlr_output_event_precommit*)data;
+            if (!(ev->state->committed & WLR_OUTPUT_STATE_BUFFER))
+            {
+                return;
+            }
+
+            uint32_t seq = output->handle->commit_seq + 1;
+            while (!queued.empty())
+            {
+                push_inflight({seq, queued.front()});
+                queued.pop_front();
+            }
+        });
+
+        on_present.set_callback([=] (void *data)
+        {
+            auto ev = (wlr_output_event_present*)data;
+            uint64_t when = wf::bench::timespec_to_us(ev->when);
+            when = when ? when : wf::bench::get_current_time_us();
+
+            // Commits are presented in order, so anything older than this commit is done.
+            while (!inflight.empty() && (int32_t(inflight.front().seq - ev->commit_seq) <= 0))
+            {
+                auto& f = inflight.front();
+                if (ev->presented && (f.seq == ev->commit_seq) && (when >= f.input_time))
+                {
+                    stats->add(when - f.input_time);
+                }
+
+                inflight.pop_front();
+            }
+        });
+
+        on_precommit.connect(&output->handle->events.precommit);
+        on_present.connect(&output->handle->events.present);
+    }
+
+    void fini() override
+    {
+        on_precommit.disconnect();
+        on_present.disconnect();
+    }
+
+    /** Record an input event which damaged this output. */
+    void add_input(uint64_t time)
+    {
+        if (queued.full())
+        {
+            queued.pop_front();
+        }
+
+        queued.push_back(time);
+    }
+
+  private:
+    void push_inflight(const inflight_t& f)
+    {
+        if (inflight.full())
+        {
+            inflight.pop_front();
+        }
+
+        inflight.push_back(f);
+    }
+};
 
 class cursor_overlay_t : public wf::scene::node_t
 {
@@ -57,10 +183,15 @@ class cursor_overlay_t : public wf::scene::node_t
     }
 };
 
-class wayfire_show_cursor : public wf::plugin_interface_t
+class wayfire_show_cursor : public wf::plugin_interface_t,
+    public wf::per_output_tracker_mixin_t<input_latency_probe_t>
 {
     wf::option_wrapper_t<bool> start_enabled{"show-cursor/start_enabled"};
+    wf::option_wrapper_t<bool> measure_latency{"show-cursor/measure_latency"};
     wf::option_wrapper_t<wf::activatorbinding_t> toggle{"show-cursor/toggle"};
+    wf::shared_data::ref_ptr_t<wf::ipc::method_repository_t> repository;
+    wf::shared_data::ref_ptr_t<wf::trace::recorder_t> tracer;
+    input_latency_stats_t latency_stats;
 
     wf::wl_timer<true> make_visible;
 
@@ -90,6 +221,10 @@ class wayfire_show_cursor : public wf::plugin_interface_t
 
         wf::scene::readd_front(wf::get_core().scene(), node);
         update_position();
+        wf::get_core().connect(&on_pre_motion);
+        wf::get_core().connect(&on_pre_motion_abs);
+        wf::get_core().connect(&on_pre_proximity);
+        wf::get_core().connect(&on_pre_axis);
         wf::get_core().connect(&on_motion);
         wf::get_core().connect(&on_motion_abs);
         wf::get_core().connect(&on_proximity);
@@ -109,6 +244,10 @@ class wayfire_show_cursor : public wf::plugin_interface_t
     void disable()
     {
         wf::scene::remove_child(node);
+        on_pre_motion.disconnect();
+        on_pre_motion_abs.disconnect();
+        on_pre_proximity.disconnect();
+        on_pre_axis.disconnect();
         on_motion.disconnect();
         on_motion_abs.disconnect();
         on_proximity.disconnect();
@@ -116,18 +255,113 @@ class wayfire_show_cursor : public wf::plugin_interface_t
         make_visible.disconnect();
     }
 
+    /**
+     * When the input event which is being handled arrived, stamped before
+     * Wayfire handles it, so that the measured latency includes its handling.
+     */
+    uint64_t input_time = 0;
+
     void update_position()
     {
+        // Without a stamp, e.g. when enabling the indicator, there is no input to measure
+        uint64_t time = std::exchange(input_time, 0);
         auto gc = wf::get_core().get_cursor_position();
         if (node)
         {
+            auto old_geometry = node->get_bounding_box();
             wf::scene::damage_node(node, node->get_bounding_box());
             node->geometry.x = gc.x - node->geometry.width / 2.0;
             node->geometry.y = gc.y - node->geometry.height / 2.0;
             wf::scene::damage_node(node, node->get_bounding_box());
+
+            if (measure_latency && time)
+            {
+                record_input(time, old_geometry, node->get_bounding_box());
+            }
+        }
+    }
+
+    /** Record the input event on each output which the indicator damaged. */
+    void record_input(uint64_t time, wf::geometry_t old_geometry, wf::geometry_t new_geometry)
+    {
+        auto intersects = [] (wf::geometry_t a, wf::geometry_t b)
+        {
+            auto i = wf::geometry_intersection(a, b);
+            return (i.width > 0) && (i.height > 0);
+        };
+
+        for (auto& [wo, probe] : output_instance)
+        {
+            auto og = wo->get_layout_geometry();
+            if (intersects(og, old_geometry) || intersects(og, new_geometry))
+            {
+                probe->add_input(time);
+            }
+        }
+    }
+
+    void handle_new_output(wf::output_t *output) override
+    {
+        per_output_tracker_mixin_t::handle_new_output(output);
+        output_instance[output]->stats = &latency_stats;
+    }
+
+    void update_latency_probe()
+    {
+        fini_output_tracking();
+        if (measure_latency)
+        {
+            init_output_tracking();
         }
     }
 
+    /**
+     * Get the latency from input events to the present of the frame which
+     * shows the moved indicator, in milliseconds.
+     */
+    wf::ipc::method_callback method_input_latency = [=] (const wf::json_t& data)
+    {
+        auto& h = latency_stats.histogram;
+
+        auto response = wf::ipc::json_ok();
+        response["enabled"] = (bool)measure_latency;
+        response["samples"] = h.size();
+        response["mean"]    = h.size() ? latency_stats.sum / 1000.0 / h.size() : 0.0;
+        response["p50"]     = h.quantile(0.50) / 1000.0;
+        response["p95"]     = h.quantile(0.95) / 1000.0;
+        response["p99"]     = h.quantile(0.99) / 1000.0;
+        response["max"]     = latency_stats.max / 1000.0;
+
+        if (data.has_member("reset") && wf::ipc::json_get_bool(data, "reset"))
+        {
+            latency_stats.reset();
+        }
+
+        return response;
+    };
+
+    wf::ipc::method_callback method_toggle = [=] (auto)
+    {
+        on_toggle(wf::activator_data_t{});
+
+        auto response = wf::ipc::json_ok();
+        response["enabled"] = currently_enabled;
+        return response;
+    };
+
+    template<class Event>
+    using pre_input_connection_t = wf::signal::connection_t<wf::input_event_signal<Event>>;
+
+    void stamp_input()
+    {
+        input_time = wf::bench::get_current_time_us();
+    }
+
+    pre_input_connection_t<wlr_pointer_motion_event> on_pre_motion = [&] (auto) { stamp_input(); };
+    pre_input_connection_t<wlr_pointer_motion_absolute_event> on_pre_motion_abs = [&] (auto) { stamp_input(); };
+    pre_input_connection_t<wlr_tablet_tool_proximity_event> on_pre_proximity = [&] (auto) { stamp_input(); };
+    pre_input_connection_t<wlr_tablet_tool_axis_event> on_pre_axis = [&] (auto) { stamp_input(); };
+
     wf::signal::connection_t<wf::post_input_event_signal<wlr_pointer_motion_event>> on_motion = [&] (auto)
     {
         update_position();
@@ -158,6 +392,13 @@ class wayfire_show_cursor : public wf::plugin_interface_t
         wf::get_core().bindings->add_activator(toggle, &on_toggle);
         currently_enabled = start_enabled;
 
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "show-cursor/input_latency", method_input_latency);
+        wf::trace::register_traced_method(repository.get(), tracer.get(),
+            "show-cursor/toggle", method_toggle);
+        measure_latency.set_callback([=] () { update_latency_probe(); });
+        update_latency_probe();
+
         if (start_enabled)
         {
             enable();
@@ -172,6 +413,9 @@ class wayfire_show_cursor : public wf::plugin_interface_t
         }
 
         wf::get_core().bindings->rem_binding(&on_toggle);
+        repository->unregister_method("show-cursor/input_latency");
+        repository->unregister_method("show-cursor/toggle");
+        fini_output_tracking();
     }
 };
 
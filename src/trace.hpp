@@ -0,0 +1,247 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+#include <time.h>
+#include "mapped-file.hpp"
+
+namespace wf
+{
+namespace trace
+{
+/**
+ * The layout of a trace file (all values are little-endian):
+ *
+ * file_header_t, then MAX_NAMES names of NAME_SIZE bytes each (NUL-terminated),
+ * then `capacity` records of type record_t.
+ *
+ * Records are written into a ring: record N is stored at index N % capacity,
+ * and `next` is the number of records written so far. scripts/wdbg.py can
+ * convert the file to the Chrome trace format.
+ */
+static constexpr char MAGIC[8] = {'W', 'F', 'T', 'R', 'A', 'C', 'E', '1'};
+static constexpr uint32_t MAX_NAMES = 256;
+static constexpr uint32_t NAME_SIZE = 48;
+
+struct file_header_t
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t capacity;
+    std::atomic<uint64_t> next;
+    uint8_t padding[32];
+};
+
+static_assert(sizeof(file_header_t) == 64, "Trace header must be 64 bytes");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Trace records need lock-free atomics");
+
+enum phase_t : uint8_t
+{
+    PHASE_BEGIN   = 'B',
+    PHASE_END     = 'E',
+    PHASE_INSTANT = 'i',
+};
+
+struct record_t
+{
+    // CLOCK_MONOTONIC in nanoseconds
+    uint64_t timestamp;
+    // Index into the name table
+    uint16_t name;
+    uint8_t phase;
+    uint8_t reserved;
+    // The track (Chrome trace thread) of the event, usually the output id
+    uint32_t track;
+    // Event-specific argument
+    uint64_t arg;
+};
+
+static_assert(sizeof(record_t) == 24, "Trace records must be 24 bytes");
+
+/**
+ * A recorder which writes trace records into a memory-mapped ring file.
+ *
+ * Recording an event does not allocate, lock or make syscalls. When tracing
+ * is not started, recording an event is just a check of a flag.
+ *
+ * The recorder is meant to be shared between plugins with
+ * wf::shared_data::ref_ptr_t<wf::trace::recorder_t>.
+ */
+class recorder_t
+{
+  public:
+    // About 400 MiB of records
+    static constexpr uint64_t MAX_CAPACITY = 1ull << 24;
+
+    ~recorder_t()
+    {
+        stop();
+    }
+
+    /**
+     * Start recording into the file at @path, which can hold @capacity records.
+     * Returns an empty string on success, or an error message.
+     */
+    std::string start(const std::string& path, uint64_t capacity)
+    {
+        stop();
+        if ((capacity == 0) || (capacity > MAX_CAPACITY))
+        {
+            return "capacity must be between 1 and " + std::to_string(MAX_CAPACITY);
+        }
+
+        size_t size = sizeof(file_header_t) + MAX_NAMES * NAME_SIZE + capacity * sizeof(record_t);
+        auto error  = file.map(path, size);
+        if (!error.empty())
+        {
+            return error;
+        }
+
+        header = new (file.get()) file_header_t{};
+        memcpy(header->magic, MAGIC, sizeof(MAGIC));
+        header->version     = 1;
+        header->record_size = sizeof(record_t);
+        header->capacity    = capacity;
+        header->next.store(0, std::memory_order_relaxed);
+
+        names_table = file.get() + sizeof(file_header_t);
+        records     = (record_t*)(names_table + MAX_NAMES * NAME_SIZE);
+        this->capacity = capacity;
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            write_name(i);
+        }
+
+        return "";
+    }
+
+    /** Stop recording. The file keeps the records written so far. */
+    void stop()
+    {
+        file.unmap();
+        header  = nullptr;
+        records = nullptr;
+    }
+
+    bool active() const
+    {
+        return header != nullptr;
+    }
+
+    uint64_t recorded() const
+    {
+        return header ? header->next.load(std::memory_order_relaxed) : 0;
+    }
+
+    /**
+     * Get the id of an event name to use in record(). Names should be interned
+     * once, e.g. when a plugin is initialized, and not on the hot path.
+     */
+    uint16_t intern(const std::string& name)
+    {
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            if (names[i] == name)
+            {
+                return i;
+            }
+        }
+
+        if (names.size() == MAX_NAMES)
+        {
+            // Out of names, fall back to the first one
+            return 0;
+        }
+
+        names.push_back(name.substr(0, NAME_SIZE - 1));
+        if (active())
+        {
+            write_name(names.size() - 1);
+        }
+
+        return names.size() - 1;
+    }
+
+    void record(uint16_t name, phase_t phase, uint32_t track, uint64_t arg = 0) noexcept
+    {
+        if (!header)
+        {
+            return;
+        }
+
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        uint64_t idx = header->next.fetch_add(1, std::memory_order_relaxed);
+        auto& r = records[idx % capacity];
+        r.timestamp = ts.tv_sec * 1'000'000'000ull + ts.tv_nsec;
+        r.name  = name;
+        r.phase = phase;
+        r.reserved = 0;
+        r.track = track;
+        r.arg   = arg;
+    }
+
+  private:
+    void write_name(size_t idx)
+    {
+        char *dst = names_table + idx * NAME_SIZE;
+        memset(dst, 0, NAME_SIZE);
+        memcpy(dst, names[idx].data(), names[idx].size());
+    }
+
+    std::vector<std::string> names;
+    wf::mapped_file_t file;
+    file_header_t *header = nullptr;
+    char *names_table     = nullptr;
+    record_t *records     = nullptr;
+    uint64_t capacity     = 0;
+};
+
+/** Records a begin event when constructed and the matching end event when destroyed. */
+class scope_t
+{
+  public:
+    scope_t(recorder_t& recorder, uint16_t name, uint32_t track, uint64_t arg = 0) :
+        recorder(recorder), name(name), track(track)
+    {
+        recorder.record(name, PHASE_BEGIN, track, arg);
+    }
+
+    ~scope_t()
+    {
+        recorder.record(name, PHASE_END, track);
+    }
+
+  private:
+    recorder_t& recorder;
+    uint16_t name;
+    uint32_t track;
+};
+
+/**
+ * Register @callback as the IPC method @method of @repository, recording each
+ * call as a span named "ipc:<method>".
+ */
+template<class Repository, class Result, class... Args>
+void register_traced_method(Repository *repository, recorder_t *recorder, const std::string& method,
+    std::function<Result(Args...)> callback)
+{
+    uint16_t name = recorder->intern("ipc:" + method);
+    repository->register_method(method, std::function<Result(Args...)>{
+        [recorder, name, callback] (Args... args)
+        {
+            scope_t trace{*recorder, name, 0};
+            return callback(std::forward<Args>(args)...);
+        }
+    });
+}
+}
+}